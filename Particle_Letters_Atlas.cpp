@@ -0,0 +1,175 @@
+//
+// Memory-mapped loader for the binary glyph atlas
+//
+
+#include "Particle_Letters_Atlas.h"
+
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+GlyphAtlas::GlyphAtlas() : data(0), size(0), filehandle(0), maphandle(0) {}
+
+GlyphAtlas::~GlyphAtlas() {
+	Close();
+}
+
+bool GlyphAtlas::Load(const std::string& filename) {
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file, &filesize) || filesize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	filehandle = file;
+	maphandle = mapping;
+	data = (char*)view;
+	size = (size_t)filesize.QuadPart;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data = (char*)view;
+	size = (size_t)st.st_size;
+#endif
+
+	if (!Validate()) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void GlyphAtlas::Close() {
+	if (!data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)maphandle);
+	CloseHandle((HANDLE)filehandle);
+#else
+	munmap(data, size);
+#endif
+
+	data = 0;
+	size = 0;
+	filehandle = 0;
+	maphandle = 0;
+}
+
+// Every block must lie inside the file, so a truncated or stale atlas is
+// rejected here instead of crashing in the renderer.
+
+static bool in_file(size_t filesize, uint32_t offset, uint32_t count, size_t elemsize) {
+	return offset % 4 == 0 && offset <= filesize && count <= (filesize - offset) / elemsize;
+}
+
+bool GlyphAtlas::Validate() const {
+	if (size < sizeof(GlyphAtlasHeader))
+		return false;
+
+	const GlyphAtlasHeader* header = (const GlyphAtlasHeader*)data;
+	if (header->magic != GLYPH_ATLAS_MAGIC || header->version != GLYPH_ATLAS_VERSION || header->filesize != size)
+		return false;
+
+	if (!in_file(size, sizeof(GlyphAtlasHeader), header->nglyphs, sizeof(GlyphRecord)))
+		return false;
+
+	for (int i = 0; i < (int)header->nglyphs; i++) {
+		const GlyphRecord& record = GetRecord(i);
+		if (!in_file(size, record.vertexoffset, record.nvertices, sizeof(GlyphVertex)) ||
+			!in_file(size, record.indexoffset, record.nindices, sizeof(uint16_t)) ||
+			!in_file(size, record.hulloffset, record.nhulls, sizeof(GlyphHull)))
+			return false;
+
+		for (int k = 0; k < (int)record.nindices; k++) {
+			if (GetIndices(record)[k] >= record.nvertices)
+				return false;
+		}
+
+		for (int h = 0; h < (int)record.nhulls; h++) {
+			const GlyphHull& hull = GetHulls(record)[h];
+			if (!in_file(size, hull.pointoffset, hull.npoints, 3 * sizeof(float)))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+int GlyphAtlas::GetNglyphs() const {
+	return data ? (int)((const GlyphAtlasHeader*)data)->nglyphs : 0;
+}
+
+const GlyphRecord& GlyphAtlas::GetRecord(int i) const {
+	return ((const GlyphRecord*)(data + sizeof(GlyphAtlasHeader)))[i];
+}
+
+const GlyphRecord* GlyphAtlas::GetGlyph(char glyph) const {
+	uint32_t code = (uint32_t)toupper((unsigned char)glyph);
+
+	for (int i = 0; i < GetNglyphs(); i++) {
+		if (GetRecord(i).glyph == code)
+			return &GetRecord(i);
+	}
+
+	return 0;
+}
+
+GlyphVertex* GlyphAtlas::GetVertices(const GlyphRecord& record) const {
+	return (GlyphVertex*)(data + record.vertexoffset);
+}
+
+uint16_t* GlyphAtlas::GetIndices(const GlyphRecord& record) const {
+	return (uint16_t*)(data + record.indexoffset);
+}
+
+const GlyphHull* GlyphAtlas::GetHulls(const GlyphRecord& record) const {
+	return (const GlyphHull*)(data + record.hulloffset);
+}
+
+const float* GlyphAtlas::GetHullPoints(const GlyphHull& hull) const {
+	return (const float*)(data + hull.pointoffset);
+}
@@ -0,0 +1,110 @@
+//
+// Binary glyph atlas: all Data/<L>.obj letter meshes baked into one file by
+// mybake (Particle_Letters_Bake.cpp) and memory-mapped at startup instead of
+// parsing the OBJ text for every letter.
+//
+// Layout (little endian, every block 4-byte aligned):
+//
+//   GlyphAtlasHeader
+//   GlyphRecord[nglyphs]
+//   per glyph: GlyphVertex[nvertices], uint16_t[nindices], GlyphHull[nhulls],
+//              float[3] hull points
+//
+// Offsets are in bytes from the start of the file. Geometry is stored the
+// way Irrlicht's OBJ loader would have produced it (X mirrored, triangle
+// winding reversed, vertices welded), so the vertex and index blocks can be
+// handed to an SMeshBuffer as-is.
+//
+// This header does not depend on Chrono or Irrlicht so the bake tool can be
+// built without them.
+//
+
+#ifndef PARTICLE_LETTERS_ATLAS_H
+#define PARTICLE_LETTERS_ATLAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#define GLYPH_ATLAS_MAGIC 0x41474C50  // "PLGA"
+#define GLYPH_ATLAS_VERSION 3
+
+struct GlyphAtlasHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nglyphs;
+	uint32_t filesize;
+};
+
+// Same memory layout as irr::video::S3DVertex
+struct GlyphVertex {
+	float pos[3];
+	float normal[3];
+	uint32_t color;  // ARGB
+	float uv[2];
+};
+
+// One piece of the glyph's convex decomposition, as a point cloud in glyph
+// coordinates. Together the hulls of a glyph cover its whole shape.
+struct GlyphHull {
+	uint32_t pointoffset;
+	uint32_t npoints;
+};
+
+struct GlyphRecord {
+	uint32_t glyph;  // uppercase character code
+	uint32_t vertexoffset;
+	uint32_t nvertices;
+	uint32_t indexoffset;
+	uint32_t nindices;
+	uint32_t hulloffset;
+	uint32_t nhulls;
+
+	// Material from the .mtl file, ARGB
+	uint32_t ambient;
+	uint32_t diffuse;
+	uint32_t specular;
+	float shininess;
+
+	float bboxmin[3];
+	float bboxmax[3];
+};
+
+// Read-only view of a mapped atlas file. Pointers returned by the accessors
+// stay valid until the atlas is closed or destroyed.
+
+class GlyphAtlas {
+public:
+	GlyphAtlas();
+	~GlyphAtlas();
+
+	// Map the file and check its header and offsets. Returns false, leaving
+	// the atlas empty, if the file is missing or malformed.
+	bool Load(const std::string& filename);
+	void Close();
+
+	bool IsLoaded() const { return data != 0; }
+	int GetNglyphs() const;
+	const GlyphRecord& GetRecord(int i) const;
+
+	// Case-insensitive lookup, returns 0 for glyphs not in the atlas
+	const GlyphRecord* GetGlyph(char glyph) const;
+
+	// The mapping is private copy-on-write, so these may be handed to APIs
+	// that take non-const arrays without ever touching the file.
+	GlyphVertex* GetVertices(const GlyphRecord& record) const;
+	uint16_t* GetIndices(const GlyphRecord& record) const;
+	const GlyphHull* GetHulls(const GlyphRecord& record) const;
+	const float* GetHullPoints(const GlyphHull& hull) const;
+
+private:
+	bool Validate() const;
+
+	char* data;
+	size_t size;
+	void* filehandle;
+	void* maphandle;
+};
+
+#endif
@@ -0,0 +1,553 @@
+//
+// Offline converter that bakes the Data/<L>.obj letter meshes into the binary
+// glyph atlas read by Particle_Letters_Atlas.cpp.
+//
+// Usage: mybake DATA_DIR OUTPUT_FILE
+//
+// Meshes are converted the way Irrlicht's OBJ loader does it (X mirrored,
+// winding reversed, vertex color from the .mtl diffuse), then welded so each
+// distinct position/normal pair is stored once.
+//
+
+#include "Particle_Letters_Atlas.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BakeMaterial {
+	uint32_t ambient;
+	uint32_t diffuse;
+	uint32_t specular;
+	float shininess;
+
+	BakeMaterial() : ambient(0xff323232), diffuse(0xffffffff), specular(0xffffffff), shininess(0) {}
+};
+
+struct BakeGlyph {
+	char glyph;
+	BakeMaterial material;
+	std::vector<GlyphVertex> vertices;
+	std::vector<uint16_t> indices;
+	std::vector<std::vector<float> > hulls;  // xyz triplets
+	float bboxmin[3];
+	float bboxmax[3];
+};
+
+static uint32_t read_color(std::istringstream& line, uint32_t alpha) {
+	float r = 0, g = 0, b = 0;
+	line >> r >> g >> b;
+	return (alpha << 24) | ((uint32_t)(r * 255) << 16) | ((uint32_t)(g * 255) << 8) | (uint32_t)(b * 255);
+}
+
+// Only the first material is used: every letter export has exactly one
+
+static BakeMaterial read_mtl(const std::string& filename) {
+	BakeMaterial material;
+	std::ifstream file(filename.c_str());
+	std::string text;
+	bool seen = false;
+
+	while (std::getline(file, text)) {
+		std::istringstream line(text);
+		std::string key;
+		line >> key;
+
+		if (key == "newmtl") {
+			if (seen)
+				break;
+			seen = true;
+		} else if (key == "Ka") {
+			material.ambient = read_color(line, 255);
+		} else if (key == "Kd") {
+			material.diffuse = read_color(line, 255);
+		} else if (key == "Ks") {
+			material.specular = read_color(line, 255);
+		} else if (key == "Ns") {
+			// wavefront shininess is from [0, 1000], scaled like Irrlicht does
+			float ns = 0;
+			line >> ns;
+			material.shininess = ns * 0.128f;
+		}
+	}
+
+	return material;
+}
+
+// OBJ indices are 1-based, negative ones count back from the end
+static int obj_index(int index, int count) {
+	return index > 0 ? index - 1 : count + index;
+}
+
+struct WeldKey {
+	long q[6];
+
+	bool operator<(const WeldKey& other) const {
+		return std::lexicographical_compare(q, q + 6, other.q, other.q + 6);
+	}
+};
+
+static bool read_obj(const std::string& filename, BakeGlyph& out) {
+	std::ifstream file(filename.c_str());
+	if (!file)
+		return false;
+
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::map<WeldKey, uint16_t> weld;
+	std::string text;
+
+	while (std::getline(file, text)) {
+		std::istringstream line(text);
+		std::string key;
+		line >> key;
+
+		if (key == "v" || key == "vn") {
+			float x = 0, y = 0, z = 0;
+			line >> x >> y >> z;
+			std::vector<float>& list = key == "v" ? positions : normals;
+			// change handedness, as Irrlicht does
+			list.push_back(-x);
+			list.push_back(y);
+			list.push_back(z);
+		} else if (key == "mtllib") {
+			std::string mtlname;
+			line >> mtlname;
+			std::string dir = filename.substr(0, filename.find_last_of("/\\") + 1);
+			out.material = read_mtl(dir + mtlname);
+		} else if (key == "f") {
+			std::vector<uint16_t> corners;
+			std::string corner;
+
+			while (line >> corner) {
+				int vi = 0, ti = 0, ni = 0;
+				if (sscanf(corner.c_str(), "%d/%d/%d", &vi, &ti, &ni) != 3 &&
+					sscanf(corner.c_str(), "%d//%d", &vi, &ni) != 2 && sscanf(corner.c_str(), "%d", &vi) != 1)
+					return false;
+
+				vi = obj_index(vi, (int)positions.size() / 3);
+				ni = ni ? obj_index(ni, (int)normals.size() / 3) : -1;
+				if (vi < 0 || 3 * vi >= (int)positions.size() || 3 * ni >= (int)normals.size())
+					return false;
+
+				GlyphVertex vertex;
+				memset(&vertex, 0, sizeof(vertex));
+				for (int k = 0; k < 3; k++) {
+					vertex.pos[k] = positions[3 * vi + k];
+					vertex.normal[k] = ni >= 0 ? normals[3 * ni + k] : 0;
+				}
+				vertex.color = out.material.diffuse;
+
+				// Weld on position and normal quantized to well below the
+				// 1e-4 precision of the 3ds Max export
+				WeldKey weldkey;
+				for (int k = 0; k < 3; k++) {
+					weldkey.q[k] = lround(vertex.pos[k] * 1e5);
+					weldkey.q[k + 3] = lround(vertex.normal[k] * 1e4);
+				}
+
+				std::map<WeldKey, uint16_t>::iterator it = weld.find(weldkey);
+				if (it == weld.end()) {
+					if (out.vertices.size() >= 65535)
+						return false;
+					it = weld.insert(std::make_pair(weldkey, (uint16_t)out.vertices.size())).first;
+					out.vertices.push_back(vertex);
+				}
+				corners.push_back(it->second);
+			}
+
+			// Triangle fan with reversed winding, as Irrlicht does
+			for (int i = 1; i + 1 < (int)corners.size(); i++) {
+				out.indices.push_back(corners[i + 1]);
+				out.indices.push_back(corners[i]);
+				out.indices.push_back(corners[0]);
+			}
+		}
+	}
+
+	return !out.indices.empty();
+}
+
+static float cross2(const float* o, const float* a, const float* b) {
+	return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+static bool less2(const std::vector<float>& a, const std::vector<float>& b) {
+	return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+}
+
+// Andrew's monotone chain on (x, z) points
+static std::vector<std::vector<float> > convex_hull_2d(std::vector<std::vector<float> > points) {
+	std::sort(points.begin(), points.end(), less2);
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	if (points.size() < 3)
+		return points;
+
+	std::vector<std::vector<float> > hull(2 * points.size());
+	int k = 0;
+	for (int i = 0; i < (int)points.size(); i++) {
+		while (k >= 2 && cross2(&hull[k - 2][0], &hull[k - 1][0], &points[i][0]) <= 0)
+			k--;
+		hull[k++] = points[i];
+	}
+	for (int i = (int)points.size() - 2, t = k + 1; i >= 0; i--) {
+		while (k >= t && cross2(&hull[k - 2][0], &hull[k - 1][0], &points[i][0]) <= 0)
+			k--;
+		hull[k++] = points[i];
+	}
+	hull.resize(k - 1);
+
+	return hull;
+}
+
+static float polygon_area(const std::vector<std::vector<float> >& polygon) {
+	float area = 0;
+	for (int i = 0; i < (int)polygon.size(); i++) {
+		const std::vector<float>& p = polygon[i];
+		const std::vector<float>& q = polygon[(i + 1) % polygon.size()];
+		area += p[0] * q[1] - q[0] * p[1];
+	}
+	return 0.5f * fabs(area);
+}
+
+// The glyphs are bevelled: the front and back faces are inset about 1 cm from
+// the outline of the body in between. Every vertex of the front face is
+// joined by a bevel edge to its offset on that widest cross-section, which
+// is the vertex of the next layer closest to it in (x, z).
+
+struct WideOutline {
+	std::vector<std::vector<float> > offset;  // per vertex index, (x, z) on the widest cross-section
+};
+
+static WideOutline find_offsets(const BakeGlyph& glyph) {
+	WideOutline wide;
+	std::vector<float> best(glyph.vertices.size(), 1e30f);
+
+	wide.offset.resize(glyph.vertices.size(), std::vector<float>(2));
+	for (int i = 0; i < (int)glyph.vertices.size(); i++) {
+		wide.offset[i][0] = glyph.vertices[i].pos[0];
+		wide.offset[i][1] = glyph.vertices[i].pos[2];
+	}
+
+	for (int t = 0; t < (int)glyph.indices.size() / 3; t++) {
+		for (int k = 0; k < 3; k++) {
+			const float* a = glyph.vertices[glyph.indices[3 * t + k]].pos;
+			const float* b = glyph.vertices[glyph.indices[3 * t + (k + 1) % 3]].pos;
+
+			// Only edges leaving the front face
+			for (int side = 0; side < 2; side++) {
+				const float* front = side ? b : a;
+				const float* back = side ? a : b;
+				int i = glyph.indices[3 * t + (side ? (k + 1) % 3 : k)];
+				if (front[1] > glyph.bboxmin[1] + 1e-5f || back[1] <= glyph.bboxmin[1] + 1e-5f)
+					continue;
+
+				float d = (back[0] - front[0]) * (back[0] - front[0]) + (back[2] - front[2]) * (back[2] - front[2]);
+				if (d < best[i]) {
+					best[i] = d;
+					wide.offset[i][0] = back[0];
+					wide.offset[i][1] = back[2];
+				}
+			}
+		}
+	}
+
+	// Welded vertices with the same position but another normal share the offset
+	std::map<std::pair<long, long>, int> closest;
+	for (int i = 0; i < (int)glyph.vertices.size(); i++) {
+		std::pair<long, long> key(lround(glyph.vertices[i].pos[0] * 1e5), lround(glyph.vertices[i].pos[2] * 1e5));
+		std::map<std::pair<long, long>, int>::iterator it = closest.find(key);
+		if (it == closest.end() || best[i] < best[it->second])
+			closest[key] = i;
+	}
+	for (int i = 0; i < (int)glyph.vertices.size(); i++) {
+		std::pair<long, long> key(lround(glyph.vertices[i].pos[0] * 1e5), lround(glyph.vertices[i].pos[2] * 1e5));
+		wide.offset[i] = wide.offset[closest[key]];
+	}
+
+	return wide;
+}
+
+// A piece of the glyph's front face: a set of its triangles, projected on (x, z)
+
+struct HullPiece {
+	std::vector<int> triangles;
+	std::vector<std::vector<float> > outline;  // convex hull of the piece on the widest cross-section
+	float hullarea;                            // area of the front face triangles' convex hull
+	float concavity;                           // 1 - triangle area / hull area, on the front face
+};
+
+static void measure_piece(const BakeGlyph& glyph, const WideOutline& wide, HullPiece& piece) {
+	std::vector<std::vector<float> > points;
+	std::vector<std::vector<float> > widepoints;
+	float area = 0;
+
+	for (int t = 0; t < (int)piece.triangles.size(); t++) {
+		std::vector<std::vector<float> > triangle;
+		for (int k = 0; k < 3; k++) {
+			int index = glyph.indices[3 * piece.triangles[t] + k];
+			const float* pos = glyph.vertices[index].pos;
+			std::vector<float> point(2);
+			point[0] = pos[0];
+			point[1] = pos[2];
+			triangle.push_back(point);
+			points.push_back(point);
+			widepoints.push_back(wide.offset[index]);
+		}
+		area += polygon_area(triangle);
+	}
+
+	// Concavity is judged on the front face, where the triangles are; the
+	// hull itself takes the offsets so it covers the widest cross-section
+	piece.hullarea = polygon_area(convex_hull_2d(points));
+	piece.concavity = piece.hullarea > 0 ? 1 - area / piece.hullarea : 0;
+	piece.outline = convex_hull_2d(widepoints);
+}
+
+// Split a piece in two by a cut across x or z through triangle centroids,
+// trying several cuts along both axes and keeping the one whose halves have
+// the least total hull area. A cut through a hole drops the hole from both
+// halves, so holes are opened first instead of bisecting the letter blindly.
+
+static void split_piece(const BakeGlyph& glyph, const WideOutline& wide, const HullPiece& piece, HullPiece& first,
+	HullPiece& second) {
+	std::vector<std::pair<float, int> > centroids[2];
+
+	for (int t = 0; t < (int)piece.triangles.size(); t++) {
+		float c[2] = { 0, 0 };
+		for (int k = 0; k < 3; k++) {
+			const float* pos = glyph.vertices[glyph.indices[3 * piece.triangles[t] + k]].pos;
+			c[0] += pos[0] / 3;
+			c[1] += pos[2] / 3;
+		}
+		for (int a = 0; a < 2; a++)
+			centroids[a].push_back(std::make_pair(c[a], piece.triangles[t]));
+	}
+
+	const int ncuts = 8;
+	float bestarea = 1e30f;
+
+	for (int a = 0; a < 2; a++) {
+		std::sort(centroids[a].begin(), centroids[a].end());
+
+		for (int c = 1; c < ncuts; c++) {
+			int cut = (int)centroids[a].size() * c / ncuts;
+			if (cut == 0 || cut == (int)centroids[a].size())
+				continue;
+
+			HullPiece lower, upper;
+			for (int i = 0; i < (int)centroids[a].size(); i++)
+				(i < cut ? lower : upper).triangles.push_back(centroids[a][i].second);
+			measure_piece(glyph, wide, lower);
+			measure_piece(glyph, wide, upper);
+
+			if (lower.hullarea + upper.hullarea < bestarea) {
+				bestarea = lower.hullarea + upper.hullarea;
+				first = lower;
+				second = upper;
+			}
+		}
+	}
+}
+
+// The letters are 3ds Max text objects extruded along Y. Their collision shape
+// is an approximate convex decomposition of the front face in (x, z): the face
+// triangles are split recursively, most concave piece first, until every
+// piece fills at least (1 - tolerance) of its own convex hull or the hull
+// budget is used up. Each piece's outline, taken on the widest cross-section
+// of the bevelled glyph, is then extruded over the glyph's depth. Pieces
+// share their boundary triangles' vertices, so hulls overlap slightly and
+// leave no gaps for particles to fall through.
+// Returns the concavity of the worst piece left, above tolerance only if the
+// budget ran out.
+
+static float compute_bounds_and_hulls(BakeGlyph& glyph, int maxhulls, float tolerance) {
+	for (int k = 0; k < 3; k++) {
+		glyph.bboxmin[k] = glyph.vertices[0].pos[k];
+		glyph.bboxmax[k] = glyph.vertices[0].pos[k];
+	}
+
+	for (int i = 0; i < (int)glyph.vertices.size(); i++) {
+		const float* pos = glyph.vertices[i].pos;
+		for (int k = 0; k < 3; k++) {
+			glyph.bboxmin[k] = std::min(glyph.bboxmin[k], pos[k]);
+			glyph.bboxmax[k] = std::max(glyph.bboxmax[k], pos[k]);
+		}
+	}
+
+	// Front face: triangles lying flat at the minimum Y
+	HullPiece face;
+	for (int t = 0; t < (int)glyph.indices.size() / 3; t++) {
+		bool flat = true;
+		for (int k = 0; k < 3; k++)
+			flat = flat && glyph.vertices[glyph.indices[3 * t + k]].pos[1] <= glyph.bboxmin[1] + 1e-5f;
+		if (flat)
+			face.triangles.push_back(t);
+	}
+	WideOutline wide = find_offsets(glyph);
+	measure_piece(glyph, wide, face);
+
+	std::vector<HullPiece> pieces(1, face);
+	int worst = 0;
+	for (;;) {
+		worst = 0;
+		for (int i = 1; i < (int)pieces.size(); i++) {
+			if (pieces[i].concavity > pieces[worst].concavity)
+				worst = i;
+		}
+		if (pieces[worst].concavity <= tolerance || pieces[worst].triangles.size() < 2 ||
+			(int)pieces.size() >= maxhulls)
+			break;
+
+		HullPiece first, second;
+		split_piece(glyph, wide, pieces[worst], first, second);
+		pieces[worst] = first;
+		pieces.push_back(second);
+	}
+
+	// Flat glyphs (E) still get some depth so the hulls are not degenerate
+	float ymin = glyph.bboxmin[1];
+	float ymax = std::max(glyph.bboxmax[1], ymin + 0.01f);
+
+	glyph.hulls.clear();
+	for (int i = 0; i < (int)pieces.size(); i++) {
+		std::vector<float> hull;
+		for (int p = 0; p < (int)pieces[i].outline.size(); p++) {
+			for (int side = 0; side < 2; side++) {
+				hull.push_back(pieces[i].outline[p][0]);
+				hull.push_back(side ? ymax : ymin);
+				hull.push_back(pieces[i].outline[p][1]);
+			}
+		}
+		glyph.hulls.push_back(hull);
+	}
+
+	return pieces[worst].concavity;
+}
+
+static void append(std::vector<char>& blob, const void* src, size_t bytes) {
+	blob.insert(blob.end(), (const char*)src, (const char*)src + bytes);
+	while (blob.size() % 4)
+		blob.push_back(0);
+}
+
+static std::vector<char> build_atlas(const std::vector<BakeGlyph>& glyphs) {
+	std::vector<char> blob;
+	std::vector<GlyphRecord> records(glyphs.size());
+
+	// Header and records go first, records are patched once offsets are known
+	GlyphAtlasHeader header;
+	header.magic = GLYPH_ATLAS_MAGIC;
+	header.version = GLYPH_ATLAS_VERSION;
+	header.nglyphs = (uint32_t)glyphs.size();
+	header.filesize = 0;
+	append(blob, &header, sizeof(header));
+	size_t recordstart = blob.size();
+	append(blob, &records[0], records.size() * sizeof(GlyphRecord));
+
+	for (int i = 0; i < (int)glyphs.size(); i++) {
+		const BakeGlyph& glyph = glyphs[i];
+		GlyphRecord& record = records[i];
+		memset(&record, 0, sizeof(record));
+
+		record.glyph = (uint32_t)glyph.glyph;
+		record.ambient = glyph.material.ambient;
+		record.diffuse = glyph.material.diffuse;
+		record.specular = glyph.material.specular;
+		record.shininess = glyph.material.shininess;
+		for (int k = 0; k < 3; k++) {
+			record.bboxmin[k] = glyph.bboxmin[k];
+			record.bboxmax[k] = glyph.bboxmax[k];
+		}
+
+		record.vertexoffset = (uint32_t)blob.size();
+		record.nvertices = (uint32_t)glyph.vertices.size();
+		append(blob, &glyph.vertices[0], glyph.vertices.size() * sizeof(GlyphVertex));
+
+		record.indexoffset = (uint32_t)blob.size();
+		record.nindices = (uint32_t)glyph.indices.size();
+		append(blob, &glyph.indices[0], glyph.indices.size() * sizeof(uint16_t));
+
+		std::vector<GlyphHull> hulls(glyph.hulls.size());
+		record.hulloffset = (uint32_t)blob.size();
+		record.nhulls = (uint32_t)hulls.size();
+		append(blob, &hulls[0], hulls.size() * sizeof(GlyphHull));
+
+		for (int h = 0; h < (int)hulls.size(); h++) {
+			hulls[h].pointoffset = (uint32_t)blob.size();
+			hulls[h].npoints = (uint32_t)glyph.hulls[h].size() / 3;
+			append(blob, &glyph.hulls[h][0], glyph.hulls[h].size() * sizeof(float));
+		}
+		memcpy(&blob[record.hulloffset], &hulls[0], hulls.size() * sizeof(GlyphHull));
+	}
+
+	header.filesize = (uint32_t)blob.size();
+	memcpy(&blob[0], &header, sizeof(header));
+	memcpy(&blob[recordstart], &records[0], records.size() * sizeof(GlyphRecord));
+
+	return blob;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cout << "Usage: " << argv[0] << " DATA_DIR OUTPUT_FILE" << std::endl;
+		return 1;
+	}
+
+	std::string datadir = argv[1];
+	if (!datadir.empty() && datadir[datadir.size() - 1] != '/' && datadir[datadir.size() - 1] != '\\')
+		datadir += "/";
+
+	std::vector<BakeGlyph> glyphs;
+
+	const int maxhulls = 64;
+	const float tolerance = 0.05f;
+
+	for (char c = 'A'; c <= 'Z'; c++) {
+		BakeGlyph glyph;
+		glyph.glyph = c;
+
+		std::string filename = datadir + c + ".obj";
+		if (!read_obj(filename, glyph)) {
+			std::cerr << "Cannot read " << filename << std::endl;
+			return 1;
+		}
+
+		// A piece still concave at the budget is filled solid by its hull:
+		// particles would bounce off geometry that is not drawn
+		float concavity = compute_bounds_and_hulls(glyph, maxhulls, tolerance);
+		glyphs.push_back(glyph);
+
+		std::cout << c << ": " << glyph.vertices.size() << " vertices, " << glyph.indices.size() / 3
+			<< " triangles, " << glyph.hulls.size() << " hulls" << std::endl;
+
+		if (concavity > tolerance) {
+			std::cerr << c << ": a collision hull is still " << (int)(100 * concavity)
+				<< "% empty after " << maxhulls << " hulls (tolerance " << (int)(100 * tolerance) << "%)"
+				<< std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<char> blob = build_atlas(glyphs);
+
+	std::ofstream out(argv[2], std::ios::binary);
+	out.write(&blob[0], blob.size());
+	if (!out) {
+		std::cerr << "Cannot write " << argv[2] << std::endl;
+		return 1;
+	}
+
+	std::cout << "Wrote " << blob.size() << " bytes to " << argv[2] << std::endl;
+
+	return 0;
+}
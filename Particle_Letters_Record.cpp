@@ -0,0 +1,308 @@
+//
+// Simulation recorder and replay player
+//
+
+#include "Particle_Letters_Record.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// Variable length integers: 7 bits per byte, low bits first, high bit set
+// on every byte but the last. Signed values are zigzag mapped first so that
+// small negative deltas stay short too.
+
+static void put_varint(std::string& out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+static bool get_varint(std::istream& in, uint32_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		int c = in.get();
+		if (c == EOF)
+			return false;
+		value |= (uint32_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static int32_t quantize(float value, float quantum) {
+	return (int32_t)floor(value / quantum + 0.5f);
+}
+
+void FrameCoder::Encode(const RecordedFrame& frame, std::string& out) {
+	size_t nslots = frame.xyzr.size() / 4;
+
+	values.resize(8 * nslots, 0);
+	spawn.resize(nslots, 0);
+
+	out.append((const char*)&frame.simtime, sizeof(frame.simtime));
+	put_varint(out, (uint32_t)nslots);
+
+	uint32_t skipped = 0;
+	for (size_t i = 0; i < nslots; i++) {
+		int32_t q[8];
+		for (int k = 0; k < 4; k++)
+			q[k] = quantize(frame.xyzr[4 * i + k], quantum);
+		for (int k = 0; k < 4; k++)
+			q[4 + k] = quantize(frame.rot[4 * i + k], 1.0f / 32767);
+
+		bool fresh = frame.spawn[i] != spawn[i];
+		bool changed = fresh;
+		for (int k = 0; k < 8 && !changed; k++)
+			changed = q[k] != values[8 * i + k];
+
+		// Sleeping and resting particles cost nothing
+		if (!changed) {
+			skipped++;
+			continue;
+		}
+
+		put_varint(out, skipped << 1 | (fresh ? 1 : 0));
+		skipped = 0;
+		spawn[i] = frame.spawn[i];
+
+		for (int k = 0; k < 8; k++) {
+			put_varint(out, zigzag(q[k] - values[8 * i + k]));
+			values[8 * i + k] = q[k];
+		}
+	}
+
+	if (skipped)
+		put_varint(out, skipped << 1);
+}
+
+bool FrameCoder::Decode(std::istream& in, RecordedFrame& frame) {
+	uint32_t nslots;
+
+	if (!in.read((char*)&frame.simtime, sizeof(frame.simtime)) || !get_varint(in, nslots))
+		return false;
+
+	values.resize(8 * nslots, 0);
+	spawn.resize(nslots, 0);
+
+	frame.xyzr.resize(4 * nslots);
+	frame.rot.resize(4 * nslots);
+	frame.spawn.resize(nslots);
+
+	for (uint32_t i = 0; i < nslots; i++) {
+		uint32_t head;
+		if (!get_varint(in, head) || (head >> 1) > nslots - i)
+			return false;
+
+		// Slots left out keep their values from the previous frame
+		for (uint32_t end = i + (head >> 1); i < end; i++)
+			unpack_slot(i, frame);
+		if (i == nslots)
+			break;
+
+		// The player only needs to know that the body changed, any new value will do
+		if (head & 1)
+			spawn[i]++;
+
+		for (int k = 0; k < 8; k++) {
+			uint32_t delta;
+			if (!get_varint(in, delta))
+				return false;
+			values[8 * i + k] += unzigzag(delta);
+		}
+
+		unpack_slot(i, frame);
+	}
+
+	return true;
+}
+
+void FrameCoder::unpack_slot(size_t i, RecordedFrame& frame) const {
+	frame.spawn[i] = spawn[i];
+	for (int k = 0; k < 4; k++)
+		frame.xyzr[4 * i + k] = values[8 * i + k] * quantum;
+	for (int k = 0; k < 4; k++)
+		frame.rot[4 * i + k] = values[8 * i + 4 + k] / 32767.0f;
+}
+
+Recorder::Recorder() : closing(false) {}
+
+Recorder::~Recorder() {
+	Close();
+}
+
+bool Recorder::Open(const std::string& filename, double dt, const std::string& letters) {
+	file.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "Cannot create recording " << filename << std::endl;
+		return false;
+	}
+
+	RecordingHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = RECORDING_MAGIC;
+	header.version = RECORDING_VERSION;
+	header.dt = dt;
+	header.quantum = 1e-4f;
+	file.write((const char*)&header, sizeof(header));
+
+	coder = FrameCoder(header.quantum);
+	closing = false;
+	writer = std::thread(&Recorder::Run, this);
+
+	SubmitLayout(letters);
+	return true;
+}
+
+void Recorder::Close() {
+	if (!writer.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(queuemutex);
+		closing = true;
+	}
+	queuecondition.notify_one();
+	writer.join();
+
+	file.close();
+}
+
+void Recorder::Submit(RecordedFrame& frame) {
+	Record record;
+	record.type = 'F';
+	std::swap(record.frame, frame);
+	Push(record);
+}
+
+void Recorder::SubmitLayout(const std::string& letters) {
+	Record record;
+	record.type = 'L';
+	record.letters = letters;
+	Push(record);
+}
+
+void Recorder::Push(Record& record) {
+	{
+		std::lock_guard<std::mutex> lock(queuemutex);
+		queue.push_back(Record());
+		std::swap(queue.back(), record);
+	}
+	queuecondition.notify_one();
+}
+
+void Recorder::Run() {
+	std::string buffer;
+	Record record;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(queuemutex);
+			while (queue.empty() && !closing)
+				queuecondition.wait(lock);
+			if (queue.empty())
+				return;
+			std::swap(record, queue.front());
+			queue.pop_front();
+		}
+
+		buffer.clear();
+		buffer.push_back(record.type);
+		if (record.type == 'L') {
+			put_varint(buffer, (uint32_t)record.letters.size());
+			buffer += record.letters;
+		} else {
+			coder.Encode(record.frame, buffer);
+		}
+
+		file.write(buffer.data(), buffer.size());
+	}
+}
+
+Player::Player() : ended(false), layoutchanged(false) {
+	memset(&header, 0, sizeof(header));
+	previous.simtime = current.simtime = -1;
+}
+
+bool Player::Open(const std::string& filename) {
+	file.open(filename.c_str(), std::ios::binary);
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != RECORDING_MAGIC ||
+		header.version != RECORDING_VERSION) {
+		std::cout << "Cannot play " << filename << ": not a particle letters recording" << std::endl;
+		return false;
+	}
+
+	coder = FrameCoder(header.quantum);
+
+	// The recorder writes the layout first
+	uint32_t length;
+	if (file.get() != 'L' || !get_varint(file, length)) {
+		std::cout << "Cannot play " << filename << ": no letter layout" << std::endl;
+		return false;
+	}
+	letters.resize(length);
+	file.read(&letters[0], length);
+
+	return true;
+}
+
+bool Player::ReadFrame(RecordedFrame& frame) {
+	for (;;) {
+		int type = file.get();
+
+		if (type == 'F')
+			return coder.Decode(file, frame);
+
+		if (type != 'L')
+			return false;
+
+		// The text changed while recording, the frames that follow use the new one
+		uint32_t length;
+		if (!get_varint(file, length))
+			return false;
+		letters.resize(length);
+		if (!file.read(&letters[0], length))
+			return false;
+		layoutchanged = true;
+	}
+}
+
+bool Player::GetParticles(double t, std::vector<float>& xyzr) {
+	while (!ended && current.simtime < t) {
+		std::swap(previous, current);
+		if (!ReadFrame(current)) {
+			// Hold the last complete frame
+			std::swap(previous, current);
+			previous = current;
+			ended = true;
+		}
+	}
+
+	double interval = current.simtime - previous.simtime;
+	float alpha = interval > 0 ? (float)std::max(0.0, std::min(1.0, (t - previous.simtime) / interval)) : 1.0f;
+
+	xyzr = current.xyzr;
+
+	size_t n = std::min(previous.spawn.size(), current.spawn.size());
+	for (size_t i = 0; i < n; i++) {
+		// New body in this slot, do not blend from the old one
+		if (previous.spawn[i] != current.spawn[i])
+			continue;
+		for (int k = 0; k < 3; k++)
+			xyzr[4 * i + k] = previous.xyzr[4 * i + k] + alpha * (current.xyzr[4 * i + k] - previous.xyzr[4 * i + k]);
+	}
+
+	return !ended;
+}
@@ -0,0 +1,167 @@
+//
+// Simulation recorder and replay player.
+//
+// The recorder streams every physics step (particle centers, orientations
+// and radii) plus the letter layout to a compact binary file from a
+// background thread; the player reads it back so a take can be rendered
+// again without running any physics.
+//
+// File layout (little endian):
+//
+//   RecordingHeader
+//   records, each starting with a one byte type:
+//     'L'  layout: varint length, letters
+//     'F'  frame:  double simtime, varint nslots, then for every slot that
+//                  changed a varint head, (number of unchanged slots
+//                  skipped before it << 1) | 1 if the slot got a new body
+//                  since the previous frame, followed by 8 zigzag varints
+//                  x, y, z, r, q0, q1, q2, q3; a last head without values
+//                  skips any unchanged slots at the end
+//
+// Positions and radii are quantized to 'quantum' meters, quaternion
+// components to 1/32767. Each value is stored as the difference from the
+// same slot in the previous frame (from 0 for new slots). A slot whose
+// quantized values did not change, such as a sleeping particle, is not
+// stored at all; a moving one takes about 10 bytes (head, r and the
+// unchanged quaternion components one byte each, the rest one or two).
+//
+// Nothing in here depends on Chrono or Irrlicht.
+//
+
+#ifndef PARTICLE_LETTERS_RECORD_H
+#define PARTICLE_LETTERS_RECORD_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RECORDING_MAGIC 0x43524C50  // "PLRC"
+#define RECORDING_VERSION 2
+
+struct RecordingHeader {
+	uint32_t magic;
+	uint32_t version;
+	double dt;
+	float quantum;
+	uint32_t reserved;
+};
+
+// State of the particle pool after one step, in pool order
+
+struct RecordedFrame {
+	double simtime;
+	std::vector<float> xyzr;           // see pack_particles
+	std::vector<float> rot;            // 4 floats per particle, see pack_rotations
+	std::vector<unsigned int> spawn;   // particlespawn
+
+	RecordedFrame() : simtime(0) {}
+};
+
+// Delta coder shared by the recorder and the player: keeps the quantized
+// values of the previous frame, slot by slot
+
+class FrameCoder {
+public:
+	explicit FrameCoder(float quantum = 1e-4f) : quantum(quantum) {}
+
+	void Encode(const RecordedFrame& frame, std::string& out);
+
+	// Returns false on truncated or malformed input
+	bool Decode(std::istream& in, RecordedFrame& frame);
+
+private:
+	// Copy slot i's current values into the frame
+	void unpack_slot(size_t i, RecordedFrame& frame) const;
+
+	float quantum;
+	std::vector<int32_t> values;       // 8 per slot
+	std::vector<unsigned int> spawn;
+};
+
+class Recorder {
+public:
+	Recorder();
+	~Recorder();
+
+	// Create the file and start the writer thread. Returns false if the
+	// file cannot be created.
+	bool Open(const std::string& filename, double dt, const std::string& letters);
+
+	// Flush every queued record and close the file
+	void Close();
+
+	bool IsOpen() const { return writer.joinable(); }
+
+	// Queue a frame for writing. The frame is moved out, leaving 'frame'
+	// empty; nothing is encoded on the calling thread.
+	void Submit(RecordedFrame& frame);
+
+	// Queue a new letter layout, applying to the frames submitted after it
+	void SubmitLayout(const std::string& letters);
+
+private:
+	struct Record {
+		char type;
+		RecordedFrame frame;
+		std::string letters;
+	};
+
+	void Run();
+	void Push(Record& record);
+
+	std::ofstream file;
+	FrameCoder coder;
+
+	std::thread writer;
+	std::mutex queuemutex;
+	std::condition_variable queuecondition;
+	std::deque<Record> queue;
+	bool closing;
+};
+
+class Player {
+public:
+	Player();
+
+	// Open a recording and read up to its first layout. Returns false if the
+	// file is missing or is not a recording.
+	bool Open(const std::string& filename);
+
+	double GetTimestep() const { return header.dt; }
+
+	// Letters of the layout in effect for the frames read so far
+	const std::string& GetLetters() const { return letters; }
+
+	// True once after GetParticles read past a new layout record
+	bool LayoutChanged() {
+		bool changed = layoutchanged;
+		layoutchanged = false;
+		return changed;
+	}
+
+	// Particle centers and radii at simulated time t, interpolated between
+	// the recorded frames around it. Reads forward as t advances; past the
+	// end of the file the last frame is held. Returns false once it is.
+	bool GetParticles(double t, std::vector<float>& xyzr);
+
+private:
+	bool ReadFrame(RecordedFrame& frame);
+
+	std::ifstream file;
+	RecordingHeader header;
+	FrameCoder coder;
+	std::string letters;
+
+	RecordedFrame previous;
+	RecordedFrame current;
+	bool ended;
+	bool layoutchanged;
+};
+
+#endif
@@ -0,0 +1,113 @@
+//
+// Batched particle rendering
+//
+
+#include "Particle_Letters_Render.h"
+
+using namespace irr;
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+ParticleBatchNode::ParticleBatchNode(ISceneNode* parent, ISceneManager* mgr, ITexture* texture, int slices,
+	int stacks)
+	: ISceneNode(parent, mgr, -1), Nparticles(0) {
+	Material.setTexture(0, texture);
+	Material.setFlag(EMF_LIGHTING, true);
+	Material.setFlag(EMF_NORMALIZE_NORMALS, false);
+
+	// Particles move every frame, so culling against a stale box would hide them
+	setAutomaticCulling(EAC_OFF);
+
+	BuildTemplate(slices, stacks);
+}
+
+void ParticleBatchNode::BuildTemplate(int slices, int stacks) {
+	SphereVertices.clear();
+	SphereIndices.clear();
+
+	for (int j = 0; j <= stacks; j++) {
+		f32 theta = PI * j / stacks;
+		for (int i = 0; i <= slices; i++) {
+			f32 phi = 2 * PI * i / slices;
+			vector3df normal(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+			SphereVertices.push_back(S3DVertex(normal, normal, SColor(255, 255, 255, 255),
+				vector2df((f32)i / slices, (f32)j / stacks)));
+		}
+	}
+
+	for (int j = 0; j < stacks; j++) {
+		for (int i = 0; i < slices; i++) {
+			u32 a = j * (slices + 1) + i;
+			u32 b = a + slices + 1;
+			SphereIndices.push_back(a);
+			SphereIndices.push_back(a + 1);
+			SphereIndices.push_back(b);
+			SphereIndices.push_back(b);
+			SphereIndices.push_back(a + 1);
+			SphereIndices.push_back(b + 1);
+		}
+	}
+}
+
+void ParticleBatchNode::SetParticles(const std::vector<float>& xyzr) {
+	u32 count = (u32)(xyzr.size() / 4);
+	u32 nvertices = (u32)SphereVertices.size();
+	u32 nindices = (u32)SphereIndices.size();
+
+	// Indices only depend on the particle count, extend them when it grows
+	if (count * nindices > Indices.size()) {
+		Indices.reallocate(count * nindices);
+		for (u32 p = Indices.size() / nindices; p < count; p++) {
+			for (u32 k = 0; k < nindices; k++)
+				Indices.push_back(p * nvertices + SphereIndices[k]);
+		}
+	}
+
+	// So do normals, colors and texture coordinates. Both arrays keep their
+	// high water mark; render() only draws the first Nparticles spheres.
+	if (count * nvertices > Vertices.size()) {
+		Vertices.reallocate(count * nvertices);
+		for (u32 p = Vertices.size() / nvertices; p < count; p++) {
+			for (u32 k = 0; k < nvertices; k++)
+				Vertices.push_back(SphereVertices[k]);
+		}
+	}
+
+	Box.reset(count ? vector3df(xyzr[0], xyzr[1], xyzr[2]) : vector3df(0, 0, 0));
+
+	// Per frame, only the positions are written
+	for (u32 p = 0; p < count; p++) {
+		vector3df center(xyzr[4 * p], xyzr[4 * p + 1], xyzr[4 * p + 2]);
+		f32 radius = xyzr[4 * p + 3];
+
+		S3DVertex* out = &Vertices[p * nvertices];
+		for (u32 k = 0; k < nvertices; k++)
+			out[k].Pos = center + SphereVertices[k].Pos * radius;
+
+		Box.addInternalPoint(center - vector3df(radius, radius, radius));
+		Box.addInternalPoint(center + vector3df(radius, radius, radius));
+	}
+
+	Nparticles = count;
+}
+
+void ParticleBatchNode::OnRegisterSceneNode() {
+	if (IsVisible && Nparticles > 0)
+		SceneManager->registerNodeForRendering(this);
+
+	ISceneNode::OnRegisterSceneNode();
+}
+
+void ParticleBatchNode::render() {
+	IVideoDriver* driver = SceneManager->getVideoDriver();
+
+	driver->setMaterial(Material);
+	driver->setTransform(ETS_WORLD, AbsoluteTransformation);
+
+	// One call for all particles; 32-bit indices so the batch is not capped at 65k vertices
+	driver->drawVertexPrimitiveList(Vertices.const_pointer(), Nparticles * (u32)SphereVertices.size(),
+		Indices.const_pointer(), Nparticles * (u32)SphereIndices.size() / 3, EVT_STANDARD, EPT_TRIANGLES,
+		EIT_32BIT);
+}
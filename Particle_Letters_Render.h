@@ -0,0 +1,50 @@
+//
+// Batched particle rendering: every live particle is drawn by one Irrlicht
+// scene node in a single draw call, instead of one ChIrrNodeAsset, mesh and
+// draw call per sphere.
+//
+
+#ifndef PARTICLE_LETTERS_RENDER_H
+#define PARTICLE_LETTERS_RENDER_H
+
+#include <irrlicht.h>
+
+#include <vector>
+
+// Scene node that expands a packed array of particle centers and radii into
+// low-poly spheres. Only the packed array changes between frames; the sphere
+// template, the index list and every vertex attribute but the position are
+// built once and grown with the particle count, so a frame rewrites nothing
+// but vertex positions.
+
+class ParticleBatchNode : public irr::scene::ISceneNode {
+public:
+	ParticleBatchNode(irr::scene::ISceneNode* parent, irr::scene::ISceneManager* mgr, irr::video::ITexture* texture,
+		int slices = 8, int stacks = 6);
+
+	// xyzr holds 4 floats per particle: center x, y, z and radius
+	void SetParticles(const std::vector<float>& xyzr);
+
+	virtual void OnRegisterSceneNode();
+	virtual void render();
+
+	virtual const irr::core::aabbox3d<irr::f32>& getBoundingBox() const { return Box; }
+	virtual irr::u32 getMaterialCount() const { return 1; }
+	virtual irr::video::SMaterial& getMaterial(irr::u32 i) { return Material; }
+
+private:
+	void BuildTemplate(int slices, int stacks);
+
+	// Unit sphere, expanded once per particle
+	std::vector<irr::video::S3DVertex> SphereVertices;
+	std::vector<irr::u32> SphereIndices;
+
+	irr::core::array<irr::video::S3DVertex> Vertices;
+	irr::core::array<irr::u32> Indices;
+	irr::u32 Nparticles;
+
+	irr::core::aabbox3d<irr::f32> Box;
+	irr::video::SMaterial Material;
+};
+
+#endif
@@ -0,0 +1,1022 @@
+//
+// Physics side of the particle letters simulation: container, letters and
+// particle spawning. Shared by the Irrlicht viewer and the headless benchmark.
+//
+
+#include "Particle_Letters_Sim.h"
+
+#include "chrono/assets/ChBoxShape.h"
+
+#ifdef PARTICLES_PARALLEL
+#include "chrono/parallel/ChOpenMP.h"
+#include "chrono/physics/ChMaterialSurfaceDEM.h"
+#include "chrono_parallel/physics/ChSystemParallel.h"
+#include "chrono_parallel/collision/ChCCollisionModelParallel.h"
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <utility>
+
+// Use the namespace of Chrono
+
+using namespace chrono;
+using namespace chrono::collision;
+
+double STATIC_flow = 100;
+double STATIC_size = .03;
+std::vector<ChSharedPtr<ChBody> > particlelist;
+std::vector<ChSharedPtr<ChBody> > letterlist;
+std::vector<double> particleradius;
+std::vector<unsigned int> particlespawn;
+std::vector<int> particleletter;
+int particlehead = 0;
+std::vector<int> letterbudget;
+std::vector<double> letterrate;
+GlyphAtlas glyphatlas;
+
+// Source of particlespawn values, never reused so that a slot whose body
+// changed can always be told apart from one that did not
+static unsigned int spawnserial = 0;
+
+// Particles that stay this slow for this long are put to sleep by Chrono:
+// they are no longer integrated but still collide, as if fixed, until a
+// moving body touches them. Particles leave the nozzle at NOZZLE_SPEED, above
+// the threshold, which also restarts the sleep timer of recycled bodies;
+// Chrono has no other way to reset it, so woken particles get it too.
+static const float PARTICLE_SLEEP_TIME = 0.5f;
+static const float PARTICLE_SLEEP_MINSPEED = 0.05f;
+static const float PARTICLE_SLEEP_MINWVEL = 0.5f;
+static const double NOZZLE_SPEED = 0.2;
+
+// Emitter footprints: for every letter, the upward facing triangles of its
+// glyph mesh in world space, flattened to x, z (6 floats per triangle), and
+// their cumulative area for area-weighted sampling. Empty without the atlas,
+// in which case particles are sprayed over the whole container as before.
+
+struct LetterFootprint {
+	std::vector<float> triangles;
+	std::vector<double> cumarea;
+
+	double GetArea() const { return cumarea.empty() ? 0 : cumarea.back(); }
+};
+
+static std::vector<LetterFootprint> footprints;
+
+// Container bodies whose size or place depends on the number of letters
+static ChSharedPtr<ChBody> floorbody;
+static ChSharedPtr<ChBody> rightwall;
+static ChSharedPtr<ChBody> backwall;
+static ChSharedPtr<ChBody> frontwall;
+
+// Lists given to set_letter_budgets and set_letter_rates, reapplied when the
+// letters change
+static std::string budgetspec;
+static std::string ratespec;
+
+// Asset cache: one ChObjShapeFile per glyph and one ChTexture per texture file
+// for the whole process. Irrlicht keys its own mesh and texture caches on the
+// same file names, so every body bound from these assets ends up sharing a
+// single IAnimatedMesh / ITexture as well.
+
+static std::map<char, ChSharedPtr<ChObjShapeFile> > glyphcache;
+static std::map<std::string, ChSharedPtr<ChTexture> > texturecache;
+
+ChSharedPtr<ChObjShapeFile> get_glyph_shape(char glyph) {
+	std::map<char, ChSharedPtr<ChObjShapeFile> >::iterator it = glyphcache.find(glyph);
+	if (it != glyphcache.end())
+		return it->second;
+
+	ChSharedPtr<ChObjShapeFile> lettermesh(new ChObjShapeFile);
+	lettermesh->SetFilename(GetChronoDataFile(std::string(1, glyph) + ".obj"));
+	glyphcache[glyph] = lettermesh;
+
+	return lettermesh;
+}
+
+ChSharedPtr<ChTexture> get_texture(const std::string& filename) {
+	std::map<std::string, ChSharedPtr<ChTexture> >::iterator it = texturecache.find(filename);
+	if (it != texturecache.end())
+		return it->second;
+
+	ChSharedPtr<ChTexture> texture(new ChTexture());
+	texture->SetTextureFilename(filename);
+	texturecache[filename] = texture;
+
+	return texture;
+}
+
+bool load_glyph_atlas() {
+#ifdef GLYPH_ATLAS_FILE
+	if (glyphatlas.Load(GLYPH_ATLAS_FILE))
+		return true;
+#endif
+	if (glyphatlas.Load(GetChronoDataFile("glyphs.atlas")))
+		return true;
+
+	std::cout << "No usable glyphs.atlas in the build or data directory (run the glyph_atlas target), "
+		"loading letters from OBJ files without collision shapes" << std::endl;
+	return false;
+}
+
+std::string filter_letters(std::string letters) {
+	for (int i = 0; i < letters.length(); i++)
+	{
+		std::string abc = "abcdefghijklmnopqrstuvwxyz QWERTYUIOPASDFGHJKLZXCVBNM";
+		if (abc.find(letters[i]) == std::string::npos)
+			letters.erase(i);
+	}
+
+	return letters;
+}
+
+// Serial runs use a plain ChSystem. With PARTICLES_PARALLEL and a thread count
+// the scene is built on ChSystemParallelDEM, whose bodies need the parallel
+// collision model and DEM materials, so every body is created through the
+// make_* helpers below.
+
+ChSystem* create_system(int nthreads) {
+#ifdef PARTICLES_PARALLEL
+	if (nthreads > 0) {
+		ChSystemParallelDEM* system = new ChSystemParallelDEM();
+		system->SetParallelThreadNumber(nthreads);
+		CHOMPfunctions::SetNumThreads(nthreads);
+		system->GetSettings()->max_threads = nthreads;
+		system->GetSettings()->perform_thread_tuning = false;
+		// No sleeping here: ChSystemParallel integrates every active body
+		return system;
+	}
+#else
+	if (nthreads > 0)
+		std::cout << "Built without PARTICLES_PARALLEL, running the serial ChSystem" << std::endl;
+#endif
+
+	ChSystem* system = new ChSystem();
+	system->SetUseSleeping(true);
+	return system;
+}
+
+bool is_parallel(ChSystem& system) {
+#ifdef PARTICLES_PARALLEL
+	return dynamic_cast<ChSystemParallelDEM*>(&system) != 0;
+#else
+	return false;
+#endif
+}
+
+int particle_cap(ChSystem& system, int nthreads) {
+	return is_parallel(system) ? 300 * nthreads : 300;
+}
+
+// Penalty contacts need a much smaller step than the 5 ms DVI step for these
+// light particles, so DEM integrates each dt in substeps of at most 0.25 ms.
+
+int dynamics_substeps(ChSystem& system, double dt) {
+	const double dem_step = 2.5e-4;
+	return is_parallel(system) ? (int)ceil(dt / dem_step - 1e-9) : 1;
+}
+
+#ifdef PARTICLES_PARALLEL
+static ChSharedPtr<ChMaterialSurfaceDEM> dem_material(float friction, float restitution) {
+	ChSharedPtr<ChMaterialSurfaceDEM> material(new ChMaterialSurfaceDEM);
+	material->SetYoungModulus(2e5f);
+	material->SetPoissonRatio(0.3f);
+	material->SetFriction(friction);
+	material->SetRestitution(restitution);
+	return material;
+}
+#endif
+
+static ChSharedPtr<ChBody> make_body(ChSystem& system) {
+#ifdef PARTICLES_PARALLEL
+	if (is_parallel(system)) {
+		ChSharedPtr<ChBody> body(new ChBody(new ChCollisionModelParallel, ChMaterialSurfaceBase::DEM));
+		body->SetMaterialSurface(dem_material(0.6f, 0.1f));
+		return body;
+	}
+#endif
+
+	return ChSharedPtr<ChBody>(new ChBody());
+}
+
+static ChSharedPtr<ChBody> make_box(ChSystem& system, double xsize, double ysize, double zsize, double density,
+	bool visual) {
+	if (!is_parallel(system))
+		return ChSharedPtr<ChBody>(new ChBodyEasyBox(xsize, ysize, zsize, density, true, visual));
+
+	// Same as ChBodyEasyBox, on a body built for the parallel system
+	ChSharedPtr<ChBody> body = make_body(system);
+	double mass = density * xsize * ysize * zsize;
+	body->SetMass(mass);
+	body->SetInertiaXX(ChVector<>((1.0 / 12.0) * mass * (ysize * ysize + zsize * zsize),
+		(1.0 / 12.0) * mass * (xsize * xsize + zsize * zsize),
+		(1.0 / 12.0) * mass * (xsize * xsize + ysize * ysize)));
+
+	body->GetCollisionModel()->ClearModel();
+	body->GetCollisionModel()->AddBox(xsize * 0.5, ysize * 0.5, zsize * 0.5);
+	body->GetCollisionModel()->BuildModel();
+	body->SetCollide(true);
+
+	if (visual) {
+		ChSharedPtr<ChBoxShape> shape(new ChBoxShape);
+		shape->GetBoxGeometry().Size = ChVector<>(xsize * 0.5, ysize * 0.5, zsize * 0.5);
+		body->AddAsset(shape);
+	}
+
+	return body;
+}
+
+static ChSharedPtr<ChBody> make_sphere(ChSystem& system, double radius, double density, float friction,
+	float restitution) {
+	if (!is_parallel(system)) {
+		ChSharedPtr<ChBodyEasySphere> body(new ChBodyEasySphere(radius,  // size
+			density, // density
+			true,    // collide enable?
+			false)); // visualization? (drawn by the batched particle renderer)
+		body->GetMaterialSurface()->SetFriction(friction);
+		body->GetMaterialSurface()->SetRestitution(restitution);
+		body->SetUseSleeping(true);
+		body->SetSleepTime(PARTICLE_SLEEP_TIME);
+		body->SetSleepMinSpeed(PARTICLE_SLEEP_MINSPEED);
+		body->SetSleepMinWvel(PARTICLE_SLEEP_MINWVEL);
+		return body;
+	}
+
+	// Same as ChBodyEasySphere, on a body built for the parallel system
+	ChSharedPtr<ChBody> body = make_body(system);
+#ifdef PARTICLES_PARALLEL
+	body->SetMaterialSurface(dem_material(friction, restitution));
+#endif
+	double mass = density * (4. / 3.) * CH_C_PI * pow(radius, 3);
+	double inertia = 0.4 * mass * pow(radius, 2);
+	body->SetMass(mass);
+	body->SetInertiaXX(ChVector<>(inertia, inertia, inertia));
+
+	body->GetCollisionModel()->ClearModel();
+	body->GetCollisionModel()->AddSphere(radius);
+	body->GetCollisionModel()->BuildModel();
+	body->SetCollide(true);
+
+	return body;
+}
+
+void build_container(ChSystem& system, const std::string& letters) {
+	// Set small collision envelopes for objects that will be created from now on..
+	ChCollisionModel::SetDefaultSuggestedEnvelope(0.002);
+	ChCollisionModel::SetDefaultSuggestedMargin(0.002);
+
+	// Create the five walls of the rectangular container, using
+	// fixed rigid bodies of 'box' type:
+	// X - Width
+	// Y - Height
+	// Z - Depth
+
+	ChSharedPtr<ChBody> floorBody = make_box(system, .7*letters.length(), .1, .5, 1000, true);
+	floorBody->SetPos(ChVector<>(0.35*letters.length() , 0, 0));//This is half of the length of the floor
+	floorBody->SetBodyFixed(true);
+
+	system.Add(floorBody);
+
+
+	ChSharedPtr<ChBody> wallBody1 = make_box(system, .1, 1, .5, 1000, true);
+	wallBody1->SetPos(ChVector<>(-.05, .5, 0));
+	wallBody1->SetBodyFixed(true);
+
+	system.Add(wallBody1);
+
+	//This is the variable wall. Right-Side Wall
+	ChSharedPtr<ChBody> wallBody2 = make_box(system, .1, 1, .5, 1000, true);
+	wallBody2->SetPos(ChVector<>(.7*letters.length()-.05, .5, 0));
+	wallBody2->SetBodyFixed(true);
+
+	system.Add(wallBody2);
+
+	ChSharedPtr<ChBody> wallBody3 = make_box(system, .7*letters.length(), 1, .1, 1000, true);
+	wallBody3->SetPos(ChVector<>(.35*letters.length(), .5, .25));
+	wallBody3->SetBodyFixed(true);
+
+	system.Add(wallBody3);
+
+	ChSharedPtr<ChBody> wallBody4 = make_box(system, .7*letters.length(), 1, .1, 1000, false);
+	wallBody4->SetPos(ChVector<>(0.35*letters.length(), .5, -.25));
+	wallBody4->SetBodyFixed(true);
+
+	system.Add(wallBody4);
+
+	// optional, attach  textures for better visualization
+	ChSharedPtr<ChTexture> mtexturewall = get_texture(GetChronoDataFile("concrete.jpg"));
+	wallBody1->AddAsset(mtexturewall);  // note: most assets can be shared
+	wallBody2->AddAsset(mtexturewall);
+	wallBody3->AddAsset(mtexturewall);
+	wallBody4->AddAsset(mtexturewall);
+	floorBody->AddAsset(mtexturewall);
+
+	floorbody = floorBody;
+	rightwall = wallBody2;
+	backwall = wallBody3;
+	frontwall = wallBody4;
+}
+
+// Swap a container box for one of a new size. Replacing the body rather than
+// rebuilding its collision model in place also works on the parallel system,
+// which copies shapes when a body is added.
+
+static void replace_box(ChSystem& system, ChSharedPtr<ChBody>& body, double xsize, double ysize, double zsize,
+	const ChVector<>& pos, bool visual, LayoutChange& change) {
+	ChSharedPtr<ChBody> box = make_box(system, xsize, ysize, zsize, 1000, visual);
+	box->SetPos(pos);
+	box->SetBodyFixed(true);
+	box->AddAsset(get_texture(GetChronoDataFile("concrete.jpg")));
+
+	system.Remove(body);
+	system.Add(box);
+
+	change.removed.push_back(body);
+	change.added.push_back(box);
+	body = box;
+}
+
+// Give a pooled particle a new radius: collision shape, mass and inertia.
+// Only called for bodies whose size differs from the current slider value.
+// The parallel system copies shapes when a body is added, so there pooled
+// particles keep the size they were created with.
+
+static void resize_particle(ChSharedPtr<ChBody> body, double sphrad, double density) {
+	double sphmass = density * (4. / 3.) * CH_C_PI * pow(sphrad, 3);
+	double sphinertia = 0.4 * sphmass * pow(sphrad, 2);
+
+	body->GetCollisionModel()->ClearModel();
+	body->GetCollisionModel()->AddSphere(sphrad);
+	body->GetCollisionModel()->BuildModel();
+	body->SetMass(sphmass);
+	body->SetInertiaXX(ChVector<>(sphinertia, sphinertia, sphinertia));
+}
+
+// Rotate the pool so the oldest particle is at index 0
+
+static void unwrap_pool() {
+	std::rotate(particlelist.begin(), particlelist.begin() + particlehead, particlelist.end());
+	std::rotate(particleradius.begin(), particleradius.begin() + particlehead, particleradius.end());
+	std::rotate(particlespawn.begin(), particlespawn.begin() + particlehead, particlespawn.end());
+	std::rotate(particleletter.begin(), particleletter.begin() + particlehead, particleletter.end());
+	particlehead = 0;
+}
+
+// Reorder a pool vector so that slot i takes the old slot order[i]
+
+template <class T>
+static void permute_slots(std::vector<T>& slots, const std::vector<int>& order) {
+	std::vector<T> permuted;
+	permuted.reserve(order.size());
+	for (int i = 0; i < order.size(); i++)
+		permuted.push_back(slots[order[i]]);
+	slots.swap(permuted);
+}
+
+static bool slot_sleeping(int slot) {
+	return particlelist[slot]->GetSleeping();
+}
+
+// Rotate the pool so the oldest particle is at index 0 and move the sleeping
+// particles ahead of the awake ones, both keeping their age order. One pass
+// over the pool, so recycling and purging then take slots from the front.
+
+static void sleeping_first() {
+	unwrap_pool();
+
+	std::vector<int> order(particlelist.size());
+	for (int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_partition(order.begin(), order.end(), slot_sleeping);
+
+	permute_slots(particlelist, order);
+	permute_slots(particleradius, order);
+	permute_slots(particlespawn, order);
+	permute_slots(particleletter, order);
+}
+
+// Wake a resting particle for good. Clearing the sleep flag alone is not
+// enough: its sleep timer still runs from when it came to rest, so Chrono
+// would put it back to sleep on the next step. A push above the sleep speed
+// restarts the timer; gravity and contacts take over from there.
+
+static void wake_particle(ChSharedPtr<ChBody> body) {
+	body->SetSleeping(false);
+	body->SetPos_dt(ChVector<>(0, -NOZZLE_SPEED, 0));
+}
+
+// Sleeping bodies are only woken by a moving body touching them, so when a
+// sleeping particle is taken out of a pile the ones resting on it would stay
+// hanging in the air. Wake every resting particle within reach of it:
+// sleeping ones and those slow enough to be on their way to sleep.
+
+static void wake_neighbours(int slot) {
+	const double envelope = 0.01;
+	ChVector<> center = particlelist[slot]->GetPos();
+
+	for (int i = 0; i < particlelist.size(); i++) {
+		if (i == slot)
+			continue;
+		if (!particlelist[i]->GetSleeping() && particlelist[i]->GetPos_dt().Length() >= PARTICLE_SLEEP_MINSPEED)
+			continue;
+
+		double reach = particleradius[slot] + particleradius[i] + envelope;
+		if ((particlelist[i]->GetPos() - center).Length2() < reach * reach)
+			wake_particle(particlelist[i]);
+	}
+}
+
+static bool under_budget(int letter, const std::vector<int>& population) {
+	return letterbudget[letter] <= 0 || population[letter] < letterbudget[letter];
+}
+
+// Pick the letter to spawn the next particle of the shared flow over: area
+// weighted among the letters without a rate of their own and still under
+// their budget, -1 if there is none
+
+static int pick_letter(const std::vector<int>& population) {
+	double total = 0;
+	for (int i = 0; i < footprints.size(); i++) {
+		if (letterrate[i] <= 0 && under_budget(i, population))
+			total += footprints[i].GetArea();
+	}
+	if (total <= 0)
+		return -1;
+
+	double r = ChRandom() * total;
+	int last = -1;
+	for (int i = 0; i < footprints.size(); i++) {
+		if (letterrate[i] > 0 || !under_budget(i, population))
+			continue;
+		if (footprints[i].GetArea() <= 0)
+			continue;
+		last = i;
+		r -= footprints[i].GetArea();
+		if (r < 0)
+			break;
+	}
+
+	return last;
+}
+
+// Uniform random point of a letter footprint, at height y
+
+static ChVector<> sample_footprint(int letter, double y) {
+	const LetterFootprint& footprint = footprints[letter];
+
+	int t = (int)(std::upper_bound(footprint.cumarea.begin(), footprint.cumarea.end(),
+		ChRandom() * footprint.GetArea()) - footprint.cumarea.begin());
+	t = std::min(t, (int)footprint.cumarea.size() - 1);
+	const float* p = &footprint.triangles[6 * t];
+
+	// Uniform barycentric coordinates
+	double u = sqrt(ChRandom());
+	double v = ChRandom();
+	double a = 1 - u;
+	double b = u * (1 - v);
+	double c = u * v;
+
+	return ChVector<>(a * p[0] + b * p[2] + c * p[4], y, a * p[1] + b * p[3] + c * p[5]);
+}
+
+// One value per letter from a comma separated list; a single value applies
+// to every letter, missing ones are 0
+
+static std::vector<double> parse_letter_values(const std::string& spec, int nletters) {
+	std::vector<double> values;
+	std::string::size_type start = 0;
+	while (start <= spec.size() && !spec.empty()) {
+		std::string::size_type end = spec.find(',', start);
+		if (end == std::string::npos)
+			end = spec.size();
+		values.push_back(atof(spec.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+
+	std::vector<double> perletter(nletters, 0);
+	for (int i = 0; i < nletters && !values.empty(); i++)
+		perletter[i] = values.size() == 1 ? values[0] : (i < values.size() ? values[i] : 0);
+	return perletter;
+}
+
+void set_letter_budgets(const std::string& spec, int nletters) {
+	budgetspec = spec;
+	std::vector<double> values = parse_letter_values(spec, nletters);
+	letterbudget.assign(values.begin(), values.end());
+}
+
+void set_letter_rates(const std::string& spec, int nletters) {
+	ratespec = spec;
+	letterrate = parse_letter_values(spec, nletters);
+}
+
+// Whole number of particles due in dt at a rate, the fraction rounded at random
+
+static int particles_due(double dt, double particles_second) {
+	double exact_particles_dt = dt * particles_second;
+	double particles_dt = floor(exact_particles_dt);
+	double remaind = exact_particles_dt - particles_dt;
+	if (remaind > ChRandom())
+		particles_dt += 1;
+	return (int)particles_dt;
+}
+
+// Function that creates debris that fall on the conveyor belt, to be called at each dt.
+// Particles live in a fixed-capacity pool: once nmaxparticles bodies exist, the
+// oldest one is teleported back to the nozzle instead of allocating a new body.
+
+int create_debris(ChSystem& system, double dt, double particles_second, const std::string& letters,
+	int nmaxparticles) {
+	double xnozzlesize = .6*letters.length();
+	double znozzlesize = .3;
+	double ynozzle = .8;
+
+	double density = 3;
+	double sphrad = STATIC_size;
+
+	int particles_dt = particles_due(dt, particles_second);
+
+	// Capacity was raised after the ring wrapped: put the oldest particle back
+	// at index 0 so new slots can simply be appended as the newest ones
+	if (particlehead != 0 && particlelist.size() < nmaxparticles)
+		unwrap_pool();
+
+	// Live particles per letter, for the budgets
+	bool targeted = false;
+	std::vector<int> population(footprints.size(), 0);
+	letterbudget.resize(footprints.size(), 0);
+	letterrate.resize(footprints.size(), 0);
+	for (int i = 0; i < footprints.size(); i++)
+		targeted = targeted || footprints[i].GetArea() > 0;
+	for (int i = 0; i < particleletter.size(); i++) {
+		if (particleletter[i] >= 0 && particleletter[i] < population.size())
+			population[particleletter[i]]++;
+	}
+
+	// Letter each particle of this dt is aimed at: the shared flow goes to
+	// letters without a rate, then each letter with a rate gets its own
+	std::vector<int> aims;
+	if (targeted) {
+		for (int i = 0; i < particles_dt; i++) {
+			int letter = pick_letter(population);
+			if (letter < 0)
+				break;  // every letter has its budget, or a rate
+			aims.push_back(letter);
+			population[letter]++;
+		}
+		for (int letter = 0; letter < footprints.size(); letter++) {
+			if (letterrate[letter] <= 0 || footprints[letter].GetArea() <= 0)
+				continue;
+			for (int n = particles_due(dt, letterrate[letter]); n > 0 && under_budget(letter, population); n--) {
+				aims.push_back(letter);
+				population[letter]++;
+			}
+		}
+	} else {
+		aims.assign(particles_dt, -1);
+	}
+
+	bool sorted = false;
+
+	for (int i = 0; i < aims.size(); i++) {
+		int letter = aims[i];
+		ChVector<> nozzlepos;
+
+		if (letter >= 0) {
+			// Straight above a point of a letter, so it lands on the glyph
+			nozzlepos = sample_footprint(letter, ynozzle + i * 0.005 + .25);
+		} else {
+			nozzlepos = ChVector<>(-.1 * xnozzlesize + ChRandom() * xnozzlesize, ynozzle + i * 0.005 + .25,
+				-0.5 * znozzlesize + ChRandom() * znozzlesize);
+		}
+		ChVector<> nozzlespeed(0, -NOZZLE_SPEED, 0);
+
+		if (particlelist.size() < nmaxparticles) {
+			ChSharedPtr<ChBody> mrigidBody = make_sphere(system, sphrad, density, 0.2f, 0.8f);
+			mrigidBody->SetPos(nozzlepos);
+			mrigidBody->SetPos_dt(nozzlespeed);
+
+			system.Add(mrigidBody);
+
+			particlelist.push_back(mrigidBody);
+			particleradius.push_back(sphrad);
+			particlespawn.push_back(++spawnserial);
+			particleletter.push_back(letter);
+			continue;
+		}
+
+		if (particlelist.empty())
+			break;
+
+		// Recycle the oldest sleeping particles, then the oldest awake ones. The
+		// pool is sorted that way once per call, before the first recycling,
+		// and not at all when the system does not sleep.
+		if (!sorted && system.GetUseSleeping())
+			sleeping_first();
+		sorted = true;
+
+		ChSharedPtr<ChBody> mrigidBody = particlelist[particlehead];
+
+		if (mrigidBody->GetSleeping()) {
+			wake_neighbours(particlehead);
+			mrigidBody->SetSleeping(false);
+		}
+
+		if (particleradius[particlehead] != sphrad && !is_parallel(system)) {
+			resize_particle(mrigidBody, sphrad, density);
+			particleradius[particlehead] = sphrad;
+		}
+
+		mrigidBody->SetPos(nozzlepos);
+		mrigidBody->SetRot(QUNIT);
+		mrigidBody->SetPos_dt(nozzlespeed);
+		mrigidBody->SetWvel_par(VNULL);
+		mrigidBody->SetPos_dtdt(VNULL);
+		mrigidBody->SetWacc_par(VNULL);
+
+		if (particleletter[particlehead] >= 0 && particleletter[particlehead] < population.size())
+			population[particleletter[particlehead]]--;
+		particlespawn[particlehead] = ++spawnserial;
+		particleletter[particlehead] = letter;
+		particlehead = (particlehead + 1) % particlelist.size();
+	}
+
+	return (int)aims.size();
+}
+
+// Function that deletes old debris when the pool capacity is lowered
+// (to avoid infinite creation that fills memory)
+
+void purge_debris(ChSystem& system, int nmaxparticles) {
+	if (particlelist.size() <= nmaxparticles)
+		return;
+
+	// Oldest particles first, sleeping ones ahead of awake ones, then drop
+	// the surplus in one erase
+	if (system.GetUseSleeping())
+		sleeping_first();
+	else
+		unwrap_pool();
+
+	int nsurplus = (int)particlelist.size() - nmaxparticles;
+	for (int i = 0; i < nsurplus; i++) {
+		if (particlelist[i]->GetSleeping())
+			wake_neighbours(i);
+		system.Remove(particlelist[i]);  // remove from physical simulation
+	}
+
+	// remove also from our particle list (will also automatically delete
+	// object thank to shared pointer)
+	particlelist.erase(particlelist.begin(), particlelist.begin() + nsurplus);
+	particleradius.erase(particleradius.begin(), particleradius.begin() + nsurplus);
+	particlespawn.erase(particlespawn.begin(), particlespawn.begin() + nsurplus);
+	particleletter.erase(particleletter.begin(), particleletter.begin() + nsurplus);
+}
+
+// Collision shape of a letter: the convex decomposition baked into the atlas.
+// Hull points are in the same (X mirrored) frame as the rendered mesh, so the
+// particles collide with the letter exactly where it is drawn.
+
+static void add_glyph_hulls(ChCollisionModel* model, char glyph) {
+	const GlyphRecord* record = glyphatlas.GetGlyph(glyph);
+	if (!record)
+		return;
+
+	for (int h = 0; h < (int)record->nhulls; h++) {
+		const GlyphHull& hull = glyphatlas.GetHulls(*record)[h];
+		const float* points = glyphatlas.GetHullPoints(hull);
+
+		std::vector<ChVector<double> > pointlist(hull.npoints);
+		for (int p = 0; p < (int)hull.npoints; p++)
+			pointlist[p] = ChVector<>(points[3 * p], points[3 * p + 1], points[3 * p + 2]);
+
+		model->AddConvexHull(pointlist);
+	}
+}
+
+// Emitter footprint of a placed letter: the triangles of its mesh that face
+// up in world space, i.e. the tops of the strokes and their bevels, which is
+// where particles falling from the nozzle land. A glyph without depth (E) has
+// none; the top of its collision hulls' bounding box stands in for it.
+
+static LetterFootprint make_footprint(ChSharedPtr<ChBody> body, char glyph) {
+	LetterFootprint footprint;
+
+	const GlyphRecord* record = glyphatlas.GetGlyph(glyph);
+	if (!record)
+		return footprint;
+
+	const GlyphVertex* vertices = glyphatlas.GetVertices(*record);
+	const uint16_t* indices = glyphatlas.GetIndices(*record);
+	double area = 0;
+
+	for (int t = 0; t + 2 < (int)record->nindices; t += 3) {
+		ChVector<> p[3];
+		for (int k = 0; k < 3; k++) {
+			const float* pos = vertices[indices[t + k]].pos;
+			p[k] = body->TransformPointLocalToParent(ChVector<>(pos[0], pos[1], pos[2]));
+		}
+
+		// Twice the signed area of the triangle projected on the floor
+		double up = (p[1].z - p[0].z) * (p[2].x - p[0].x) - (p[1].x - p[0].x) * (p[2].z - p[0].z);
+		if (up <= 0)
+			continue;
+
+		for (int k = 0; k < 3; k++) {
+			footprint.triangles.push_back((float)p[k].x);
+			footprint.triangles.push_back((float)p[k].z);
+		}
+		area += 0.5 * up;
+		footprint.cumarea.push_back(area);
+	}
+
+	if (area > 0 || record->nhulls == 0)
+		return footprint;
+
+	double xmin = 1e30, xmax = -1e30, zmin = 1e30, zmax = -1e30;
+	for (int h = 0; h < (int)record->nhulls; h++) {
+		const GlyphHull& hull = glyphatlas.GetHulls(*record)[h];
+		const float* points = glyphatlas.GetHullPoints(hull);
+		for (int k = 0; k < (int)hull.npoints; k++) {
+			ChVector<> p = body->TransformPointLocalToParent(
+				ChVector<>(points[3 * k], points[3 * k + 1], points[3 * k + 2]));
+			xmin = std::min(xmin, p.x);
+			xmax = std::max(xmax, p.x);
+			zmin = std::min(zmin, p.z);
+			zmax = std::max(zmax, p.z);
+		}
+	}
+
+	// Two triangles, wound to face up like the ones above
+	float rectangle[12] = { (float)xmin, (float)zmin, (float)xmin, (float)zmax, (float)xmax, (float)zmax,
+		(float)xmin, (float)zmin, (float)xmax, (float)zmax, (float)xmax, (float)zmin };
+	footprint.triangles.assign(rectangle, rectangle + 12);
+	area = 0.5 * (xmax - xmin) * (zmax - zmin);
+	footprint.cumarea.push_back(area);
+	footprint.cumarea.push_back(2 * area);
+
+	return footprint;
+}
+
+static ChVector<> letter_position(int i) {
+	return ChVector<>(.65*(i) + .35, .1, 0);
+}
+
+// Create the body of the letter at position i and add it to the system
+
+static ChSharedPtr<ChBody> make_letter(ChSystem& system, char glyph, int i) {
+	ChSharedPtr<ChBody> letterBody = make_body(system);
+
+	// Repeated characters share the same mesh and texture assets
+	ChSharedPtr<ChObjShapeFile> lettermesh = get_glyph_shape(glyph);
+	ChSharedPtr<ChTexture> lettertexture = get_texture(GetChronoDataFile("bluwhite.png"));
+
+	letterBody->AddAsset(lettermesh);
+	letterBody->SetBodyFixed(true);
+	letterBody->GetCollisionModel()->ClearModel();
+	add_glyph_hulls(letterBody->GetCollisionModel(), glyph);
+	letterBody->GetCollisionModel()->BuildModel();
+	letterBody->SetCollide(true);
+	letterBody->SetPos(letter_position(i));
+	// Glyphs are extruded along their y: stand them up, front face toward the camera
+	letterBody->SetRot(Q_from_AngAxis(CH_C_PI_2, VECT_X));
+
+	system.Add(letterBody);
+
+	letterBody->AddAsset(lettertexture);
+
+	return letterBody;
+}
+
+void assemble_letters(ChSystem& system, const std::string& letters) {
+	for (int i = 0; i < letters.length(); i++) {
+		ChSharedPtr<ChBody> letterBody = make_letter(system, letters[i], i);
+
+		footprints.push_back(make_footprint(letterBody, letters[i]));
+
+		letterlist.push_back(letterBody);
+	};
+}
+
+// Range of x covered by letter i, from its footprint or, without the atlas,
+// from its slot in the layout
+
+static std::pair<double, double> letter_extent(int i) {
+	const std::vector<float>& triangles = footprints[i].triangles;
+	if (triangles.empty()) {
+		double x = letterlist[i]->GetPos().x;
+		return std::make_pair(x - .35, x + .35);
+	}
+
+	std::pair<double, double> extent(triangles[0], triangles[0]);
+	for (int k = 0; k < triangles.size(); k += 2) {
+		extent.first = std::min(extent.first, (double)triangles[k]);
+		extent.second = std::max(extent.second, (double)triangles[k]);
+	}
+	return extent;
+}
+
+// Remove every particle that overlaps one of the x ranges from the pool and
+// from the system. Returns how many were removed.
+
+static int evict_particles(ChSystem& system, const std::vector<std::pair<double, double> >& ranges) {
+	unwrap_pool();
+
+	std::vector<bool> evict(particlelist.size(), false);
+	for (int i = 0; i < particlelist.size(); i++) {
+		double x = particlelist[i]->GetPos().x;
+		double r = particleradius[i];
+		for (int k = 0; k < ranges.size(); k++)
+			evict[i] = evict[i] || (x + r > ranges[k].first && x - r < ranges[k].second);
+	}
+
+	// Wake the neighbours while every evicted particle is still in place
+	for (int i = 0; i < particlelist.size(); i++) {
+		if (evict[i] && particlelist[i]->GetSleeping())
+			wake_neighbours(i);
+	}
+
+	int nkept = 0;
+	for (int i = 0; i < particlelist.size(); i++) {
+		if (evict[i]) {
+			system.Remove(particlelist[i]);
+			continue;
+		}
+		particlelist[nkept] = particlelist[i];
+		particleradius[nkept] = particleradius[i];
+		particlespawn[nkept] = particlespawn[i];
+		particleletter[nkept] = particleletter[i];
+		nkept++;
+	}
+
+	int nevicted = (int)particlelist.size() - nkept;
+	particlelist.resize(nkept);
+	particleradius.resize(nkept);
+	particlespawn.resize(nkept);
+	particleletter.resize(nkept);
+
+	return nevicted;
+}
+
+// Longest common subsequence of the two texts, as the index in 'newletters'
+// each old letter is kept at (-1 if it goes). Case is ignored, both cases
+// share a glyph.
+
+static std::vector<int> match_letters(const std::string& oldletters, const std::string& newletters) {
+	int n = (int)oldletters.length();
+	int m = (int)newletters.length();
+
+	std::vector<int> lcs((n + 1) * (m + 1), 0);
+	for (int i = n - 1; i >= 0; i--) {
+		for (int j = m - 1; j >= 0; j--) {
+			if (toupper(oldletters[i]) == toupper(newletters[j]))
+				lcs[i * (m + 1) + j] = lcs[(i + 1) * (m + 1) + j + 1] + 1;
+			else
+				lcs[i * (m + 1) + j] = std::max(lcs[(i + 1) * (m + 1) + j], lcs[i * (m + 1) + j + 1]);
+		}
+	}
+
+	std::vector<int> newindex(n, -1);
+	int i = 0;
+	int j = 0;
+	while (i < n && j < m) {
+		if (toupper(oldletters[i]) == toupper(newletters[j])) {
+			newindex[i++] = j++;
+		} else if (lcs[(i + 1) * (m + 1) + j] >= lcs[i * (m + 1) + j + 1]) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+
+	return newindex;
+}
+
+void relayout_letters(ChSystem& system, const std::string& oldletters, const std::string& newletters,
+	LayoutChange& change) {
+	int n = (int)oldletters.length();
+	int m = (int)newletters.length();
+
+	std::vector<int> newindex = match_letters(oldletters, newletters);
+	std::vector<int> oldindex(m, -1);
+	for (int i = 0; i < n; i++) {
+		if (newindex[i] >= 0)
+			oldindex[newindex[i]] = i;
+	}
+
+	// Regions whose particles must go: where letters were and are now, for
+	// every letter that is added, removed or moved
+	std::vector<std::pair<double, double> > ranges;
+
+	for (int i = 0; i < n; i++) {
+		if (newindex[i] == i)
+			continue;
+		ranges.push_back(letter_extent(i));
+		if (newindex[i] < 0) {
+			system.Remove(letterlist[i]);
+			change.removed.push_back(letterlist[i]);
+		}
+	}
+
+	std::vector<ChSharedPtr<ChBody> > oldlist;
+	std::vector<LetterFootprint> oldfootprints;
+	std::swap(oldlist, letterlist);
+	std::swap(oldfootprints, footprints);
+
+	for (int j = 0; j < m; j++) {
+		int i = oldindex[j];
+
+		if (i == j) {
+			letterlist.push_back(oldlist[i]);
+			footprints.push_back(oldfootprints[i]);
+			continue;
+		}
+
+		ChSharedPtr<ChBody> letterBody;
+		if (i >= 0) {
+			letterBody = oldlist[i];
+			letterBody->SetPos(letter_position(j));
+		} else {
+			letterBody = make_letter(system, newletters[j], j);
+			change.added.push_back(letterBody);
+		}
+
+		letterlist.push_back(letterBody);
+		footprints.push_back(make_footprint(letterBody, newletters[j]));
+		ranges.push_back(letter_extent(j));
+	}
+
+	// Container: the floor and the front and back walls follow the text
+	// length, the right wall moves with its end
+	if (m != n) {
+		replace_box(system, floorbody, .7*m, .1, .5, ChVector<>(0.35*m, 0, 0), true, change);
+		replace_box(system, backwall, .7*m, 1, .1, ChVector<>(.35*m, .5, .25), true, change);
+		replace_box(system, frontwall, .7*m, 1, .1, ChVector<>(0.35*m, .5, -.25), false, change);
+		rightwall->SetPos(ChVector<>(.7*m - .05, .5, 0));
+
+		// Everything beyond the new right wall, when the container shrinks
+		if (m < n)
+			ranges.push_back(std::make_pair(.7*m - .1, 1e30));
+	}
+
+	// Particles keep the letter they were aimed at, under its new index
+	for (int k = 0; k < particleletter.size(); k++) {
+		if (particleletter[k] >= 0 && particleletter[k] < n)
+			particleletter[k] = newindex[particleletter[k]];
+	}
+
+	change.nevicted = evict_particles(system, ranges);
+
+	set_letter_budgets(budgetspec, m);
+	set_letter_rates(ratespec, m);
+}
+
+void pack_particles(std::vector<float>& xyzr) {
+	xyzr.resize(4 * particlelist.size());
+
+	for (int i = 0; i < particlelist.size(); i++) {
+		const ChVector<>& pos = particlelist[i]->GetPos();
+		xyzr[4 * i] = (float)pos.x;
+		xyzr[4 * i + 1] = (float)pos.y;
+		xyzr[4 * i + 2] = (float)pos.z;
+		xyzr[4 * i + 3] = (float)particleradius[i];
+	}
+}
+
+void pack_rotations(std::vector<float>& rot) {
+	rot.resize(4 * particlelist.size());
+
+	for (int i = 0; i < particlelist.size(); i++) {
+		const ChQuaternion<>& q = particlelist[i]->GetRot();
+		rot[4 * i] = (float)q.e0;
+		rot[4 * i + 1] = (float)q.e1;
+		rot[4 * i + 2] = (float)q.e2;
+		rot[4 * i + 3] = (float)q.e3;
+	}
+}
+
+int step_scene(ChSystem& system, double dt, double particles_second, const std::string& letters,
+	int nmaxparticles, PhaseTimes& times) {
+	PhaseClock clock;
+
+	int substeps = dynamics_substeps(system, dt);
+	for (int i = 0; i < substeps; i++) {
+		system.DoStepDynamics(dt / substeps);
+		times.step += system.GetTimerStep();
+		times.collision += system.GetTimerCollisionBroad() + system.GetTimerCollisionNarrow();
+		times.solve += system.GetTimerLcp();
+	}
+
+	clock.start();
+	int spawned = create_debris(system, dt, particles_second, letters, nmaxparticles);
+	times.spawn += clock.stop();
+
+	clock.start();
+	purge_debris(system, nmaxparticles);
+	times.purge += clock.stop();
+
+	return spawned;
+}
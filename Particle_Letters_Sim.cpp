@@ -27,13 +27,22 @@
 // ------------------------------------------------
 ///////////////////////////////////////////////////
 
-#include "chrono/physics/ChSystem.h"
-#include "chrono/physics/ChBodyEasy.h"
+#include "Particle_Letters_Sim.h"
+#include "Particle_Letters_Record.h"
+#include "Particle_Letters_Render.h"
+#include "Particle_Letters_Thread.h"
+
 #include "chrono/physics/ChConveyor.h"
 
 #include "chrono_irrlicht/ChIrrApp.h"
+#include "chrono_irrlicht/ChIrrNodeAsset.h"
 
+#include <cctype>
+#include <cstdlib>
+#include <cwchar>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 
 // Use the namespace of Chrono
@@ -50,22 +59,85 @@ using namespace video;
 using namespace io;
 using namespace gui;
 
-// Static values valid through the entire program (bad
-// programming practice, but enough for quick tests)
+// Put the atlas meshes in Irrlicht's mesh cache under the same names the
+// ChObjShapeFile assets use, so binding a letter finds the mesh already there
+// and never parses the OBJ text. The mesh buffers point straight into the
+// mapped atlas file (zero-copy); only the GPU upload makes a copy.
+
+static void register_glyph_meshes(ISceneManager* scenemanager, const GlyphAtlas& atlas) {
+	static_assert(sizeof(GlyphVertex) == sizeof(S3DVertex), "atlas vertex layout must match S3DVertex");
+
+	for (int i = 0; i < atlas.GetNglyphs(); i++) {
+		const GlyphRecord& record = atlas.GetRecord(i);
+
+		SMeshBuffer* buffer = new SMeshBuffer();
+		buffer->Vertices.set_pointer((S3DVertex*)atlas.GetVertices(record), record.nvertices, false, false);
+		buffer->Indices.set_pointer(atlas.GetIndices(record), record.nindices, false, false);
+		buffer->BoundingBox = aabbox3df(record.bboxmin[0], record.bboxmin[1], record.bboxmin[2],
+			record.bboxmax[0], record.bboxmax[1], record.bboxmax[2]);
+		buffer->Material.AmbientColor = SColor(record.ambient);
+		buffer->Material.DiffuseColor = SColor(record.diffuse);
+		buffer->Material.SpecularColor = SColor(record.specular);
+		buffer->Material.Shininess = record.shininess;
+		buffer->setHardwareMappingHint(EHM_STATIC);
+
+		SMesh* mesh = new SMesh();
+		mesh->addMeshBuffer(buffer);
+		mesh->recalculateBoundingBox();
+		buffer->drop();
+
+		SAnimatedMesh* animatedmesh = new SAnimatedMesh(mesh);
+		mesh->drop();
+
+		// Lowercase input uses the same glyph
+		std::string upper(1, (char)record.glyph);
+		std::string lower(1, (char)tolower(record.glyph));
+		scenemanager->getMeshCache()->addMesh(GetChronoDataFile(upper + ".obj").c_str(), animatedmesh);
+		scenemanager->getMeshCache()->addMesh(GetChronoDataFile(lower + ".obj").c_str(), animatedmesh);
+		animatedmesh->drop();
+	}
+}
+
+// Switch the scene to a new text: relayout_letters changes the bodies, then
+// the new ones get Irrlicht nodes and the nodes of removed ones are dropped.
+// The camera slides along so it keeps framing the word as it did.
+
+static void change_letters(ChIrrApp& application, ChSystem& system, const std::string& oldletters,
+	const std::string& newletters) {
+	LayoutChange change;
+	relayout_letters(system, oldletters, newletters, change);
+
+	for (int i = 0; i < change.removed.size(); i++) {
+		std::vector<ChSharedPtr<ChAsset> >& assets = change.removed[i]->GetAssets();
+		for (int k = 0; k < assets.size(); k++) {
+			if (assets[k].IsType<ChIrrNodeAsset>())
+				assets[k].DynamicCastTo<ChIrrNodeAsset>()->GetIrrlichtNode()->remove();
+		}
+	}
+
+	for (int i = 0; i < change.added.size(); i++) {
+		application.AssetBind(change.added[i]);
+		application.AssetUpdate(change.added[i]);
+	}
+
+	double growth = (double)newletters.length() - (double)oldletters.length();
+	ICameraSceneNode* camera = application.GetSceneManager()->getActiveCamera();
+	camera->setPosition(camera->getPosition() + core::vector3df((f32)(.25 * growth), 0, (f32)(-.3 * growth)));
+	camera->setTarget(camera->getTarget() + core::vector3df((f32)(.25 * growth), 0, 0));
 
-double STATIC_flow = 100;
-double STATIC_size = .03;
-std::vector<ChSharedPtr<ChBody> > particlelist;
-std::vector<ChSharedPtr<ChBody> > letterlist;
+	std::cout << "Letters " << newletters << ": " << change.added.size() << " bodies added, "
+		<< change.removed.size() << " removed, " << change.nevicted << " particles evicted" << std::endl;
+}
 
 // Define a MyEventReceiver class which will be used to manage input
 // from the GUI graphical user interface
 
 class MyEventReceiver : public IEventReceiver {
 public:
-	MyEventReceiver(ChIrrAppInterface* myapp) {
+	MyEventReceiver(ChIrrAppInterface* myapp, PhysicsThread* myphysics) {
 		// store pointer applicaiton
 		application = myapp;
+		physics = myphysics;
 
 		// ..add a GUI slider to control particles flow
 		scrollbar_flow = application->GetIGUIEnvironment()->addScrollBar(true, rect<s32>(510, 85, 650, 100), 0, 101);
@@ -80,6 +152,33 @@ public:
 		scrollbar_speed->setPos(5);
 		text_speed = application->GetIGUIEnvironment()->addStaticText(L"Particle Size [m]",
 			rect<s32>(650, 125, 750, 140), false);
+
+		// ..add a panel with live counters and timings, below the sliders
+		text_stats = application->GetIGUIEnvironment()->addStaticText(L"", rect<s32>(510, 165, 750, 320), true,
+			true, 0, -1, true);
+	}
+
+	// Show counters and per-frame / per-step averages over the last refresh interval
+	void ShowStats(const SimStats& stats, double drawtime, int nframes) {
+		double perframe = nframes > 0 ? 1e3 / nframes : 0;
+		double perstep = stats.nsteps > 0 ? 1e3 / stats.nsteps : 0;
+
+		wchar_t text[512];
+		swprintf(text, 512,
+			L"bodies %d (%d sleeping)\n"
+			L"particles %d\n"
+			L"contacts %d\n"
+			L"\n"
+			L"draw      %6.2f ms/frame\n"
+			L"step      %6.2f ms/step\n"
+			L"  collision %6.2f\n"
+			L"  solve     %6.2f\n"
+			L"spawn     %6.2f ms/step\n"
+			L"purge     %6.2f ms/step\n",
+			stats.nbodies, stats.nsleeping, stats.nparticles, stats.ncontacts, drawtime * perframe,
+			stats.times.step * perstep, stats.times.collision * perstep, stats.times.solve * perstep,
+			stats.times.spawn * perstep, stats.times.purge * perstep);
+		text_stats->setText(text);
 	}
 
 	bool OnEvent(const SEvent& event) {
@@ -90,15 +189,18 @@ public:
 
 			switch (event.GUIEvent.EventType) {
 			case EGET_SCROLL_BAR_CHANGED:
+				// the physics thread owns STATIC_flow and STATIC_size, post the change to it
 				if (id == 101)  // id of 'flow' slider..
 				{
 					s32 pos = ((IGUIScrollBar*)event.GUIEvent.Caller)->getPos();
-					STATIC_flow = (double)pos;
+					SimCommand command = { SimCommand::SET_FLOW, (double)pos };
+					physics->Post(command);
 				}
 				if (id == 102)  // id of 'size' slider..
 				{
 					s32 pos = ((IGUIScrollBar*)event.GUIEvent.Caller)->getPos();
-					STATIC_size = ((double)pos) / 100;
+					SimCommand command = { SimCommand::SET_SIZE, ((double)pos) / 100 };
+					physics->Post(command);
 				}
 				break;
 			}
@@ -109,120 +211,72 @@ public:
 
 private:
 	ChIrrAppInterface* application;
+	PhysicsThread* physics;
 
 	IGUIScrollBar* scrollbar_flow;
 	IGUIStaticText* text_flow;
 	IGUIScrollBar* scrollbar_speed;
 	IGUIStaticText* text_speed;
+	IGUIStaticText* text_stats;
 };
 
-// Function that creates debris that fall on the conveyor belt, to be called at each dt
-
-void create_debris(ChIrrApp& application, double dt, double particles_second, std::string letters) {
-	double xnozzlesize = .6*letters.length();
-	double znozzlesize = .3;
-	double ynozzle = .8;
-
-	double density = 3;
-	double sphrad = STATIC_size;
-	double sphmass = (4 / 3) * CH_C_PI * pow(sphrad, 3) * density;
-	double sphinertia = pow(sphrad, 2) * sphmass;
-
-	double exact_particles_dt = dt * particles_second;
-	double particles_dt = floor(exact_particles_dt);
-	double remaind = exact_particles_dt - particles_dt;
-	if (remaind > ChRandom())
-		particles_dt += 1;
-
-	video::ITexture* bluwhiteMap = application.GetVideoDriver()->getTexture(GetChronoDataFile("bluwhite.png").c_str());
-	
-	for (int i = 0; i < particles_dt; i++) {
-		double rand_fract = ChRandom();
-
-			ChSharedPtr<ChBodyEasySphere> mrigidBody(new ChBodyEasySphere(sphrad,  // size
-				3,       // density
-				true,    // collide enable?
-				true));  // visualization?
-			mrigidBody->SetPos(ChVector<>(-.1 * xnozzlesize + ChRandom() * xnozzlesize, ynozzle + i * 0.005 + .25,
-				-0.5 * znozzlesize + ChRandom() * znozzlesize));
-			mrigidBody->GetMaterialSurface()->SetFriction(0.2f);
-			mrigidBody->GetMaterialSurface()->SetRestitution(0.8f);
-			mrigidBody->AddAsset(ChSharedPtr<ChTexture>(new ChTexture(GetChronoDataFile("bluwhite.png"))));
-
-			application.GetSystem()->Add(mrigidBody);
-
-			// This will make particle's visualization assets visible in Irrlicht:
-			application.AssetBind(mrigidBody);
-			application.AssetUpdate(mrigidBody);
-
-			particlelist.push_back(mrigidBody);
-		
+int main(int argc, char* argv[]) {
+	// Optional: --threads N runs the scene on ChSystemParallelDEM (PARTICLES_PARALLEL builds),
+	// --record FILE streams the simulation to FILE, --play FILE replays it without physics,
+	// --csv FILE writes one line of counters and timings per rendered frame,
+	// --budget N[,N...] limits the live particles aimed at each letter,
+	// --rate R[,R...] drops R particles/s on each letter instead of a share of the flow slider
+	int nthreads = 0;
+	std::string recordfile;
+	std::string playfile;
+	std::string csvfile;
+	std::string budgets;
+	std::string rates;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::string(argv[i]) == "--threads")
+			nthreads = atoi(argv[i + 1]);
+		if (std::string(argv[i]) == "--record")
+			recordfile = argv[i + 1];
+		if (std::string(argv[i]) == "--play")
+			playfile = argv[i + 1];
+		if (std::string(argv[i]) == "--csv")
+			csvfile = argv[i + 1];
+		if (std::string(argv[i]) == "--budget")
+			budgets = argv[i + 1];
+		if (std::string(argv[i]) == "--rate")
+			rates = argv[i + 1];
 	}
 
-}
-
-// Function that deletes old debris (to avoid infinite creation that fills memory)
+	Player player;
+	bool playing = !playfile.empty();
+	std::string letters;
 
-void purge_debris(ChIrrAppInterface& application, int nmaxparticles = 1000) {
-	while (particlelist.size() > nmaxparticles) {
-		application.GetSystem()->Remove(particlelist[0]);  // remove from physical simulation
-		particlelist.erase(particlelist.begin());  // remove also from our particle list (will also automatically delete
-												   // object thank to shared pointer)
+	if (playing) {
+		// The recording knows its letters
+		if (!player.Open(playfile))
+			return 1;
+		letters = player.GetLetters();
+	} else {
+		//Take in characters to simulate
+		std::cout << "Please input letters" << std::endl;
+		std::cin >> letters;
 	}
-}
-
-void assemble_letters(ChIrrApp& application, std::string letters) {
-	for (int i = 0; i < letters.length(); i++) {
-		ChSharedPtr<ChBody> letterBody(new ChBody());
-		ChSharedPtr<ChObjShapeFile> lettermesh(new ChObjShapeFile);
-		ChSharedPtr<ChTexture> lettertexture(new ChTexture());
-
-		std::string str;
-		str = letters[i];
-
-		lettermesh->SetFilename(GetChronoDataFile((str + ".obj")));
-		lettertexture->SetTextureFilename(GetChronoDataFile("bluwhite.png"));
-
-		letterBody->AddAsset(lettermesh);
-		letterBody->SetBodyFixed(true);
-		letterBody->GetCollisionModel()->ClearModel();
-		letterBody->GetCollisionModel()->BuildModel();
-		letterBody->SetCollide(true);
-		letterBody->SetPos(ChVector<>( .65*(i) + .35, .1, 0));
-		letterBody->SetRot(Q_from_AngAxis(90, ChVector<>(90, 0, 0)));
 
-		application.GetSystem()->Add(letterBody);
-		std::cout << letterBody->GetCollide() << std::endl;
+	letters = filter_letters(letters);
 
 
-		letterBody->AddAsset(lettertexture);
-
-		application.AssetBind(letterBody);
-		application.AssetUpdate(letterBody);
-
-		letterlist.push_back(letterBody);
-
-
-	};
-}
-
-int main(int argc, char* argv[]) {
-	//Take in characters to simulate
-	std::cout << "Please input letters" << std::endl;
-	std::string letters;
-	std::cin >> letters;
+	// Create a ChronoENGINE physical system
+	std::unique_ptr<ChSystem> system(create_system(nthreads));
+	ChSystem& mphysicalSystem = *system;
 
-	for (int i = 0; i < letters.length(); i++)
-	{
-		std::string abc = "abcdefghijklmnopqrstuvwxyz QWERTYUIOPASDFGHJKLZXCVBNM";
-		if (abc.find(letters[i]) == std::string::npos)
-			letters.erase(i);
-	}
-	
+	int nmaxparticles = particle_cap(mphysicalSystem, nthreads);
 
+	// Physics runs on its own thread at a fixed 5 ms step (started once the scene is built)
+	Recorder recorder;
+	PhysicsThread physics(mphysicalSystem, letters, nmaxparticles, 0.005);
 
-	// Create a ChronoENGINE physical system
-	ChSystem mphysicalSystem;
+	if (!recordfile.empty() && !playing && recorder.Open(recordfile, 0.005, letters))
+		physics.SetRecorder(&recorder);
 
 	// Create the Irrlicht visualization (open the Irrlicht device,
 	// bind a simple user interface, etc. etc.)
@@ -237,93 +291,154 @@ int main(int argc, char* argv[]) {
 		core::vector3df((f32).25*letters.length(), 0, 0));
 
 	// This is for GUI tweaking of system parameters..
-	MyEventReceiver receiver(&application);
+	MyEventReceiver receiver(&application, &physics);
 	// note how to add the custom event receiver to the default interface:
 	application.SetUserEventReceiver(&receiver);
 
-	// Set small collision envelopes for objects that will be created from now on..
-	ChCollisionModel::SetDefaultSuggestedEnvelope(0.002);
-	ChCollisionModel::SetDefaultSuggestedMargin(0.002);
-
-	// Create the five walls of the rectangular container, using
-	// fixed rigid bodies of 'box' type:
-	// X - Width
-	// Y - Height
-	// Z - Depth
-
-	ChSharedPtr<ChBodyEasyBox> floorBody(new ChBodyEasyBox(.7*letters.length(), .1, .5, 1000, true, true));
-	floorBody->SetPos(ChVector<>(0.35*letters.length() , 0, 0));//This is half of the length of the floor
-	floorBody->SetBodyFixed(true);
-
-	application.GetSystem()->Add(floorBody);
-	
-
-	ChSharedPtr<ChBodyEasyBox> wallBody1(new ChBodyEasyBox(.1, 1, .5, 1000, true, true));
-	wallBody1->SetPos(ChVector<>(-.05, .5, 0));
-	wallBody1->SetBodyFixed(true);
-
-	application.GetSystem()->Add(wallBody1);
+	if (load_glyph_atlas())
+		register_glyph_meshes(application.GetSceneManager(), glyphatlas);
 
-	//This is the variable wall. Right-Side Wall
-	ChSharedPtr<ChBodyEasyBox> wallBody2(new ChBodyEasyBox(.1, 1, .5, 1000, true, true));
-	wallBody2->SetPos(ChVector<>(.7*letters.length()-.05, .5, 0));
-	wallBody2->SetBodyFixed(true);
+	// Container walls and letters are shared with the headless benchmark
+	build_container(mphysicalSystem, letters);
 
-	application.GetSystem()->Add(wallBody2);
-
-	ChSharedPtr<ChBodyEasyBox> wallBody3(new ChBodyEasyBox(.7*letters.length(), 1, .1, 1000, true, true));
-	wallBody3->SetPos(ChVector<>(.35*letters.length(), .5, .25));
-	wallBody3->SetBodyFixed(true);
-
-	application.GetSystem()->Add(wallBody3);
-
-	ChSharedPtr<ChBodyEasyBox> wallBody4(new ChBodyEasyBox(.7*letters.length(), 1, .1, 1000, true, false));
-	wallBody4->SetPos(ChVector<>(0.35*letters.length(), .5, -.25));
-	wallBody4->SetBodyFixed(true);
-
-	application.GetSystem()->Add(wallBody4);
-
-	// optional, attach  textures for better visualization
-	ChSharedPtr<ChTexture> mtexturewall(new ChTexture());
-	mtexturewall->SetTextureFilename(GetChronoDataFile("concrete.jpg"));
-	wallBody1->AddAsset(mtexturewall);  // note: most assets can be shared
-	wallBody2->AddAsset(mtexturewall);
-	wallBody3->AddAsset(mtexturewall);
-	wallBody4->AddAsset(mtexturewall);
-	floorBody->AddAsset(mtexturewall);
-
-	assemble_letters(application, letters);
+	assemble_letters(mphysicalSystem, letters);
+	set_letter_budgets(budgets, (int)letters.length());
+	set_letter_rates(rates, (int)letters.length());
 
 	// Create an Irrlicht 'directory' where debris will be put during the simulation loop
 	ISceneNode* parent = application.GetSceneManager()->addEmptySceneNode();
 
+	// All particles are drawn by this one node, from their packed positions and radii
+	ParticleBatchNode* particlenode = new ParticleBatchNode(parent, application.GetSceneManager(),
+		application.GetVideoDriver()->getTexture(GetChronoDataFile("bluwhite.png").c_str()));
+	particlenode->drop();
+	std::vector<float> particlexyzr;
+
 	//
 	// THE SOFT-REAL-TIME CYCLE
 	//
 	application.AssetBindAll();
 	application.AssetUpdateAll();
 
-	application.SetStepManage(true);
-	application.SetTimestep(0.005);
+	// From here on only the physics thread touches the ChSystem. It continuosly
+	// creates debris and recycles the oldest particles; this thread just draws
+	// the latest snapshot. Letters and walls are fixed bodies, only moved by
+	// this thread with the step mutex held, so their Irrlicht nodes can keep
+	// reading their positions.
+	// When playing a recording the physics thread is never started and the
+	// system only holds the container and the letters.
+	LineReader input;
+
+	if (!playing) {
+		physics.Start();
+
+		// Every further line on stdin replaces the text
+		std::cout << "Type new letters and press Enter to change them" << std::endl;
+		input.Start(std::cin);
+	}
+
+	bool paused = false;
+	double playtime = 0;
+	PhaseClock frameclock;
+	frameclock.start();
+
+	// Timings for the stats panel, refreshed 4 times per second, and the CSV
+	std::ofstream csv;
+	if (!csvfile.empty()) {
+		csv.open(csvfile.c_str());
+		csv << "time,draw_ms,steps,simtime,particles,bodies,sleeping,contacts,"
+			"step_ms,collision_ms,solve_ms,spawn_ms,purge_ms" << std::endl;
+	}
+
+	PhaseClock wallclock;
+	PhaseClock drawclock;
+	PhaseClock panelclock;
+	wallclock.start();
+	panelclock.start();
+
+	SimStats panelstats;
+	double paneldraw = 0;
+	int panelframes = 0;
 
 	while (application.GetDevice()->run()) {
-		application.GetVideoDriver()->beginScene(true, true, SColor(255, 140, 161, 192));
+		// New text from stdin, or from a layout record of the recording being played
+		std::string line;
+		if (playing ? player.LayoutChanged() : input.Poll(line)) {
+			std::string newletters = filter_letters(playing ? player.GetLetters() : line);
+
+			if (!newletters.empty() && newletters != letters) {
+				std::lock_guard<std::mutex> lock(physics.GetStepMutex());
+				change_letters(application, mphysicalSystem, letters, newletters);
+				physics.SetLetters(newletters);
+				if (recorder.IsOpen())
+					recorder.SubmitLayout(newletters);
+				letters = newletters;
+			}
+		}
+
+		// The pause key is handled by ChIrrApp on this thread, forward it
+		if (application.GetPaused() != paused) {
+			paused = application.GetPaused();
+			SimCommand command = { SimCommand::SET_PAUSED, paused ? 1.0 : 0.0 };
+			physics.Post(command);
+		}
+
+		// Playback follows the wall clock, stopped while paused
+		double frametime = frameclock.stop();
+		frameclock.start();
+		if (!paused)
+			playtime += frametime;
 
-		application.DrawAll();
+		application.GetVideoDriver()->beginScene(true, true, SColor(255, 140, 161, 192));
 
-		application.DoStep();
+		if (playing)
+			player.GetParticles(playtime, particlexyzr);
+		else
+			physics.GetParticles(particlexyzr);
+		particlenode->SetParticles(particlexyzr);
 
-		if (!application.GetPaused()) {
-			// Continuosly create debris that fall on the conveyor belt
-			create_debris(application, application.GetTimestep(), STATIC_flow, letters);
+		// Not ChIrrApp::DrawAll, whose info panels read the ChSystem while it is stepping
+		drawclock.start();
+		application.GetSceneManager()->drawAll();
+		application.GetIGUIEnvironment()->drawAll();
+		double drawtime = drawclock.stop();
 
-			// Limit the max number of debris particles on the scene, deleting the oldest ones, for performance
-			purge_debris(application, 300);
+		application.GetVideoDriver()->endScene();
 
+		SimStats stats;
+		physics.GetStats(stats);
+
+		if (csv.is_open()) {
+			// Timings of the physics steps completed during this frame, averaged per step
+			double perstep = stats.nsteps > 0 ? 1e3 / stats.nsteps : 0;
+			csv << wallclock.stop() << ',' << 1e3 * drawtime << ',' << stats.nsteps << ',' << stats.simtime << ','
+				<< stats.nparticles << ',' << stats.nbodies << ',' << stats.nsleeping << ',' << stats.ncontacts << ','
+				<< stats.times.step * perstep << ',' << stats.times.collision * perstep << ','
+				<< stats.times.solve * perstep << ',' << stats.times.spawn * perstep << ','
+				<< stats.times.purge * perstep << '\n';
 		}
 
-		application.GetVideoDriver()->endScene();
+		// Counters from the latest step, timings summed over the interval
+		if (stats.nsteps > 0) {
+			stats.nsteps += panelstats.nsteps;
+			stats.times += panelstats.times;
+			panelstats = stats;
+		}
+		paneldraw += drawtime;
+		panelframes++;
+
+		if (panelclock.stop() > 0.25) {
+			receiver.ShowStats(panelstats, paneldraw, panelframes);
+			panelstats.nsteps = 0;
+			panelstats.times = PhaseTimes();
+			paneldraw = 0;
+			panelframes = 0;
+			panelclock.start();
+		}
 	}
 
+	physics.Stop();
+	recorder.Close();
+
 	return 0;
 }
\ No newline at end of file
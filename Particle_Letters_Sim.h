@@ -0,0 +1,174 @@
+//
+// Scene building blocks shared by the Irrlicht viewer (myexe) and the
+// headless benchmark (mybench). Nothing in here depends on Irrlicht, so
+// the physics side can be driven with a bare ChSystem.
+//
+
+#ifndef PARTICLE_LETTERS_SIM_H
+#define PARTICLE_LETTERS_SIM_H
+
+#include "chrono/physics/ChSystem.h"
+#include "chrono/physics/ChBodyEasy.h"
+#include "chrono/assets/ChObjShapeFile.h"
+#include "chrono/assets/ChTexture.h"
+
+#include "Particle_Letters_Atlas.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Static values valid through the entire program (bad
+// programming practice, but enough for quick tests)
+
+extern double STATIC_flow;
+extern double STATIC_size;
+extern std::vector<chrono::ChSharedPtr<chrono::ChBody> > particlelist;
+extern std::vector<chrono::ChSharedPtr<chrono::ChBody> > letterlist;
+
+// Particle pool: particlelist is a ring buffer of bodies that are recycled once
+// it holds nmaxparticles, particlehead indexes the oldest one, particleradius
+// the radius each body was last built with and particlespawn a serial number,
+// unique per spawn, that changes whenever a slot gets a different or recycled
+// body (a teleport, not a move, for interpolation).
+extern std::vector<double> particleradius;
+extern std::vector<unsigned int> particlespawn;
+extern int particlehead;
+
+// Index in letterlist of the letter each particle was aimed at, -1 for
+// particles sprayed over the whole container
+extern std::vector<int> particleletter;
+
+// Most live particles aimed at each letter, 0 for no limit
+extern std::vector<int> letterbudget;
+
+// Particles per second dropped on each letter on its own, 0 for a share of
+// the flow slider proportional to the letter's area
+extern std::vector<double> letterrate;
+
+// Letter meshes baked by mybake, mapped once for the whole process
+extern GlyphAtlas glyphatlas;
+
+// Wall clock accumulated per phase of a simulation step, in seconds.
+// 'collision' and 'solve' come from the ChSystem timers of the last
+// DoStepDynamics, the other phases are measured around our own calls.
+
+struct PhaseTimes {
+	double spawn;
+	double purge;
+	double collision;
+	double solve;
+	double step;
+
+	PhaseTimes() : spawn(0), purge(0), collision(0), solve(0), step(0) {}
+
+	PhaseTimes& operator+=(const PhaseTimes& other) {
+		spawn += other.spawn;
+		purge += other.purge;
+		collision += other.collision;
+		solve += other.solve;
+		step += other.step;
+		return *this;
+	}
+};
+
+// Bodies touched by relayout_letters, for the visualization to catch up
+
+struct LayoutChange {
+	std::vector<chrono::ChSharedPtr<chrono::ChBody> > added;    // new in the system, not bound yet
+	std::vector<chrono::ChSharedPtr<chrono::ChBody> > removed;  // already out of the system
+	int nevicted;                                             // particles removed with them
+
+	LayoutChange() : nevicted(0) {}
+};
+
+// Simple stopwatch used to time the phases that Chrono does not time itself
+
+class PhaseClock {
+public:
+	void start() { t0 = std::chrono::high_resolution_clock::now(); }
+	double stop() const {
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point t0;
+};
+
+// Shared visualization assets, created on first use and kept for the whole process
+chrono::ChSharedPtr<chrono::ChObjShapeFile> get_glyph_shape(char glyph);
+chrono::ChSharedPtr<chrono::ChTexture> get_texture(const std::string& filename);
+
+// Map the glyph atlas baked by the build (GLYPH_ATLAS_FILE), or failing that
+// glyphs.atlas in the Chrono data directory. Returns false if neither is
+// usable (missing or stale), in which case letters fall back to their
+// Data/<L>.obj files and get no collision shape.
+bool load_glyph_atlas();
+
+// Physics system for the scene: a serial ChSystem, or ChSystemParallelDEM on
+// nthreads threads when built with PARTICLES_PARALLEL and nthreads > 0
+chrono::ChSystem* create_system(int nthreads);
+bool is_parallel(chrono::ChSystem& system);
+
+// Particle pool capacity: 300, scaled by the thread count on the parallel system
+int particle_cap(chrono::ChSystem& system, int nthreads);
+
+// Number of DoStepDynamics calls that make up one dt (more than one for DEM)
+int dynamics_substeps(chrono::ChSystem& system, double dt);
+
+// Drop every character we have no glyph mesh for
+std::string filter_letters(std::string letters);
+
+// Set collision envelopes and create the floor and the four walls of the container
+void build_container(chrono::ChSystem& system, const std::string& letters);
+
+// Create one fixed body per character, laid out along X, colliding through
+// the convex hulls of its glyph in the atlas. Also records the area of the
+// floor each letter covers, seen from above, for the emitter.
+void assemble_letters(chrono::ChSystem& system, const std::string& letters);
+
+// Set letterbudget from a comma separated list, one budget per letter; a
+// single value applies to all of them
+void set_letter_budgets(const std::string& spec, int nletters);
+
+// Same for letterrate
+void set_letter_rates(const std::string& spec, int nletters);
+
+// Change the text from oldletters to newletters in place. Letters are
+// matched by a longest common subsequence: kept letters keep their bodies
+// and only move if their index changed, the others are removed or created.
+// The floor and the front and back walls are swapped for boxes of the new
+// length and the right wall moved. Only particles over letters that changed
+// or moved, or beyond a shrunk container, are evicted.
+void relayout_letters(chrono::ChSystem& system, const std::string& oldletters, const std::string& newletters,
+	LayoutChange& change);
+
+// Spawn the particles due in this dt, allocating bodies until the pool holds
+// nmaxparticles and recycling the oldest ones after that, sleeping particles
+// first (serial ChSystem only, the parallel one does not sleep). Particles carry no
+// visualization assets, renderers read them through pack_particles.
+// With the glyph atlas loaded particles are dropped only straight above the
+// letters: particles_second is shared by area among the letters without a
+// rate, each letter with one gets its letterrate, and a letter at its budget
+// gets nothing until some of its particles are recycled. Without the atlas
+// they are sprayed over the whole container.
+// Returns how many particles were spawned.
+int create_debris(chrono::ChSystem& system, double dt, double particles_second, const std::string& letters,
+	int nmaxparticles);
+
+// Delete the oldest particles beyond nmaxparticles, if the pool capacity was
+// lowered, sleeping particles first
+void purge_debris(chrono::ChSystem& system, int nmaxparticles = 1000);
+
+// Pack the centers and radii of all pooled particles as x, y, z, r, in pool order
+void pack_particles(std::vector<float>& xyzr);
+
+// Pack the orientations of all pooled particles as quaternions e0, e1, e2, e3, in pool order
+void pack_rotations(std::vector<float>& rot);
+
+// One iteration of the simulation loop without any rendering: integrate by dt,
+// then spawn and purge particles. Phase timings are added to 'times'.
+int step_scene(chrono::ChSystem& system, double dt, double particles_second, const std::string& letters,
+	int nmaxparticles, PhaseTimes& times);
+
+#endif
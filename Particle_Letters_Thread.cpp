@@ -0,0 +1,179 @@
+//
+// Physics thread with fixed-step stepping and interpolated snapshots
+//
+
+#include "Particle_Letters_Thread.h"
+
+#include <algorithm>
+#include <istream>
+
+using namespace chrono;
+
+PhysicsThread::PhysicsThread(ChSystem& system, const std::string& letters, int nmaxparticles, double dt)
+	: system(system), letters(letters), nmaxparticles(nmaxparticles), dt(dt), paused(false), recorder(0),
+	running(false) {
+	back.simtime = current.simtime = previous.simtime = 0;
+	back.walltime = current.walltime = previous.walltime = std::chrono::steady_clock::now();
+}
+
+PhysicsThread::~PhysicsThread() {
+	Stop();
+}
+
+void PhysicsThread::Start() {
+	if (running)
+		return;
+
+	running = true;
+	thread = std::thread(&PhysicsThread::Run, this);
+}
+
+void PhysicsThread::Stop() {
+	if (!running)
+		return;
+
+	running = false;
+	thread.join();
+}
+
+bool PhysicsThread::Post(const SimCommand& command) {
+	return commands.Push(command);
+}
+
+void PhysicsThread::ApplyCommands() {
+	SimCommand command;
+
+	while (commands.Pop(command)) {
+		switch (command.type) {
+		case SimCommand::SET_FLOW:
+			STATIC_flow = command.value;
+			break;
+		case SimCommand::SET_SIZE:
+			STATIC_size = command.value;
+			break;
+		case SimCommand::SET_PAUSED:
+			paused = command.value != 0;
+			break;
+		}
+	}
+}
+
+void PhysicsThread::Run() {
+	typedef std::chrono::steady_clock clock;
+	clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(dt));
+	clock::time_point next = clock::now();
+
+	while (running) {
+		ApplyCommands();
+
+		if (!paused) {
+			SimStats step;
+			{
+				std::lock_guard<std::mutex> lock(stepmutex);
+				step_scene(system, dt, STATIC_flow, letters, nmaxparticles, step.times);
+				pack_particles(back.xyzr);
+				back.spawn = particlespawn;
+				back.simtime = system.GetChTime();
+
+				step.nsteps = 1;
+				step.simtime = back.simtime;
+				step.nparticles = (int)particlelist.size();
+				step.nbodies = system.GetNbodies();
+				step.nsleeping = system.GetNbodiesSleeping();
+				step.ncontacts = system.GetNcontacts();
+
+				// Only copies here, the recorder encodes and writes on its own thread
+				if (recorder) {
+					frame.simtime = back.simtime;
+					frame.xyzr = back.xyzr;
+					frame.spawn = back.spawn;
+					pack_rotations(frame.rot);
+					recorder->Submit(frame);
+				}
+			}
+			Publish(step);
+		}
+
+		// Keep simulated time in step with the wall clock. When a step takes
+		// longer than dt, simulation slows down instead of trying to catch up.
+		next += period;
+		clock::time_point now = clock::now();
+		if (next < now)
+			next = now;
+		else
+			std::this_thread::sleep_until(next);
+	}
+}
+
+void PhysicsThread::Publish(const SimStats& step) {
+	back.walltime = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(snapshotmutex);
+	std::swap(previous, current);
+	std::swap(current, back);
+
+	// Counters are replaced, step counts and timings accumulate until GetStats
+	int nsteps = stats.nsteps;
+	PhaseTimes times = stats.times;
+	stats = step;
+	stats.nsteps += nsteps;
+	stats.times += times;
+}
+
+void PhysicsThread::GetStats(SimStats& out) {
+	std::lock_guard<std::mutex> lock(snapshotmutex);
+	out = stats;
+
+	stats.nsteps = 0;
+	stats.times = PhaseTimes();
+}
+
+void PhysicsThread::GetParticles(std::vector<float>& xyzr) {
+	std::lock_guard<std::mutex> lock(snapshotmutex);
+
+	// Render one snapshot interval behind the physics: blend from 'previous'
+	// to 'current' over the time it took to produce 'current'
+	double interval = std::chrono::duration<double>(current.walltime - previous.walltime).count();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - current.walltime).count();
+	float alpha = interval > 0 ? (float)std::min(1.0, elapsed / interval) : 1.0f;
+
+	xyzr = current.xyzr;
+
+	size_t n = std::min(previous.spawn.size(), current.spawn.size());
+	for (size_t i = 0; i < n; i++) {
+		// Recycled since the previous snapshot: it was teleported, do not blend
+		if (previous.spawn[i] != current.spawn[i])
+			continue;
+		for (int k = 0; k < 3; k++)
+			xyzr[4 * i + k] = previous.xyzr[4 * i + k] + alpha * (current.xyzr[4 * i + k] - previous.xyzr[4 * i + k]);
+	}
+}
+
+void LineReader::Start(std::istream& in) {
+	shared = std::make_shared<Shared>();
+	std::thread(&LineReader::Run, &in, shared).detach();
+}
+
+// Only the latest line matters, a burst of edits is applied as one change
+
+void LineReader::Run(std::istream* in, std::shared_ptr<Shared> shared) {
+	std::string line;
+	while (std::getline(*in, line)) {
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		shared->line = line;
+		shared->fresh = true;
+	}
+}
+
+bool LineReader::Poll(std::string& line) {
+	if (!shared)
+		return false;
+
+	std::lock_guard<std::mutex> lock(shared->mutex);
+	if (!shared->fresh)
+		return false;
+
+	line = shared->line;
+	shared->fresh = false;
+	return true;
+}
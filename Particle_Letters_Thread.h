@@ -0,0 +1,175 @@
+//
+// Physics on its own thread: the scene is stepped at a fixed dt in real time,
+// independently of the Irrlicht frame rate, and publishes particle snapshots
+// that the render thread interpolates between.
+//
+
+#ifndef PARTICLE_LETTERS_THREAD_H
+#define PARTICLE_LETTERS_THREAD_H
+
+#include "Particle_Letters_Sim.h"
+#include "Particle_Letters_Record.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Changes requested by the GUI, applied by the physics thread between steps
+
+struct SimCommand {
+	enum Type { SET_FLOW, SET_SIZE, SET_PAUSED };
+
+	Type type;
+	double value;
+};
+
+// Lock-free single-producer / single-consumer ring of N - 1 elements
+
+template <class T, unsigned int N>
+class SpscQueue {
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	// Producer side; false if the queue is full
+	bool Push(const T& item) {
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		unsigned int next = (t + 1) % N;
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+		items[t] = item;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side; false if the queue is empty
+	bool Pop(T& item) {
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = items[h];
+		head.store((h + 1) % N, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::atomic<unsigned int> head;
+	std::atomic<unsigned int> tail;
+	T items[N];
+};
+
+// Counters and timings of the physics steps since the last GetStats call
+
+struct SimStats {
+	int nsteps;
+	PhaseTimes times;  // summed over the nsteps
+
+	// After the last of the nsteps
+	double simtime;
+	int nparticles;
+	int nbodies;
+	int nsleeping;
+	int ncontacts;
+
+	SimStats() : nsteps(0), simtime(0), nparticles(0), nbodies(0), nsleeping(0), ncontacts(0) {}
+};
+
+// Particle state after one physics step
+
+struct ParticleSnapshot {
+	double simtime;
+	std::chrono::steady_clock::time_point walltime;
+	std::vector<float> xyzr;            // see pack_particles
+	std::vector<unsigned int> spawn;    // particlespawn at the time of the snapshot
+};
+
+class PhysicsThread {
+public:
+	// dt is the fixed step; each step runs dynamics_substeps DoStepDynamics calls
+	PhysicsThread(chrono::ChSystem& system, const std::string& letters, int nmaxparticles, double dt);
+	~PhysicsThread();
+
+	void Start();
+	void Stop();
+
+	// Stream every step to 'recorder', which must stay open until Stop().
+	// Call before Start().
+	void SetRecorder(Recorder* recorder) { this->recorder = recorder; }
+
+	// Called from the GUI thread. Returns false if the command queue is full.
+	bool Post(const SimCommand& command);
+
+	// Particle positions and radii interpolated between the last two snapshots
+	// for the current wall clock time. Called from the render thread.
+	void GetParticles(std::vector<float>& xyzr);
+
+	// Statistics of the steps taken since the previous call. Called from the render thread.
+	void GetStats(SimStats& stats);
+
+	// Held by the physics thread around every step. Other threads lock it to
+	// add or remove bodies while the physics thread is not stepping.
+	std::mutex& GetStepMutex() { return stepmutex; }
+
+	// New text for the emitter. Call with the step mutex held, together with
+	// relayout_letters.
+	void SetLetters(const std::string& letters) { this->letters = letters; }
+
+private:
+	void Run();
+	void ApplyCommands();
+	void Publish(const SimStats& step);
+
+	chrono::ChSystem& system;
+	std::string letters;
+	int nmaxparticles;
+	double dt;
+
+	SpscQueue<SimCommand, 256> commands;
+	bool paused;
+
+	Recorder* recorder;
+	RecordedFrame frame;
+
+	std::thread thread;
+	std::atomic<bool> running;
+	std::mutex stepmutex;
+
+	// Snapshots: 'back' is written by the physics thread, then rotated into
+	// 'current' (and 'current' into 'previous') under snapshotmutex
+	std::mutex snapshotmutex;
+	ParticleSnapshot back;
+	ParticleSnapshot current;
+	ParticleSnapshot previous;
+	SimStats stats;
+};
+
+// Reads lines from a stream (stdin) on a thread of its own, so a blocking
+// read never holds up rendering. The thread is detached: it may still be
+// waiting for input when the program ends.
+
+class LineReader {
+public:
+	void Start(std::istream& in);
+
+	// Most recent line read since the previous call, if any
+	bool Poll(std::string& line);
+
+private:
+	// Owned jointly with the reader thread, which may outlive this object
+	struct Shared {
+		std::mutex mutex;
+		std::string line;
+		bool fresh;
+
+		Shared() : fresh(false) {}
+	};
+
+	static void Run(std::istream* in, std::shared_ptr<Shared> shared);
+
+	std::shared_ptr<Shared> shared;
+};
+
+#endif